@@ -0,0 +1,93 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * app_slot.c
+ *
+ * Application slots: the application area is divided into SD_BOOT_APP_SLOTS
+ * slots of SD_BOOT_APP_SLOT_SIZE, each of which keeps a loaded image resident
+ * (the slot table is part of the boot state), so switching back to an image
+ * does not read the card or touch the flash.
+ *
+ * Images are linked for the start of the application area. On RP2350 such an
+ * image can be launched from any slot: the QMI address translation windows are
+ * shifted so the slot appears at SD_BOOT_FLASH_OFFSET. The translation applies
+ * to reads through XIP only, an application that programs its own flash has
+ * to be kept in slot 0. On RP2040 an image for slot 0 always goes to slot 0;
+ * the other slots take position specific builds linked for their address.
+ */
+
+#include "pico/stdlib.h"
+#if PICO_RP2350
+#include "hardware/structs/qmi.h"
+#endif
+#include "app_slot.h"
+
+#if PICO_RP2350
+#define ATRANS_WINDOW_SIZE  (4 * 1024 * 1024) // Address space covered by one window
+#define ATRANS_WINDOWS      4                 // Windows for chip select 0
+#define XIP_CACHE_BYTES     (16 * 1024)
+#define XIP_CACHE_LINE      8
+#endif
+
+_Static_assert(SD_BOOT_APP_SLOT_SIZE % FLASH_SECTOR_SIZE == 0, "slots must be whole sectors");
+_Static_assert((uint64_t)SD_BOOT_APP_SLOTS * SD_BOOT_APP_SLOT_SIZE <= MAX_APP_SIZE, "slots exceed the flash");
+
+int app_slot_of_offset(uint32_t flash_offset)
+{
+    if (flash_offset < SD_BOOT_FLASH_OFFSET)
+        return -1;
+    uint32_t slot = (flash_offset - SD_BOOT_FLASH_OFFSET) / SD_BOOT_APP_SLOT_SIZE;
+    return slot < SD_BOOT_APP_SLOTS ? (int)slot : -1;
+}
+
+int app_slot_linked_for(const uint32_t *vectors)
+{
+    return app_slot_of_offset(vectors[1] - XIP_BASE);
+}
+
+// A slot other than 0 holding an image linked for slot 0
+static bool is_translated(int slot)
+{
+    const uint32_t *vectors = (const uint32_t *)(XIP_BASE + app_slot_offset(slot));
+    return APP_SLOT_TRANSLATION && slot != 0 && app_slot_linked_for(vectors) == 0;
+}
+
+uint32_t *app_slot_vector_table(int slot)
+{
+    int target = is_translated(slot) ? 0 : slot;
+    return (uint32_t *)(XIP_BASE + app_slot_offset(target));
+}
+
+void __not_in_flash_func(app_slot_map)(int slot)
+{
+#if PICO_RP2350
+    if (!is_translated(slot))
+        return;
+
+    // Window i translates its 4MB of address space to BASE * 4KB onwards
+    uint32_t shift = (app_slot_offset(slot) - SD_BOOT_FLASH_OFFSET) / FLASH_SECTOR_SIZE;
+    uint32_t atrans[ATRANS_WINDOWS];
+    for (int i = 0; i < ATRANS_WINDOWS; i++)
+    {
+        uint32_t base = i * (ATRANS_WINDOW_SIZE / FLASH_SECTOR_SIZE) + shift;
+        atrans[i] = ((ATRANS_WINDOW_SIZE / FLASH_SECTOR_SIZE) << QMI_ATRANS0_SIZE_LSB) |
+                    (base & QMI_ATRANS0_BASE_BITS);
+    }
+
+    // From here on only RAM may be used: the loader's flash is remapped
+    for (int i = 0; i < ATRANS_WINDOWS; i++)
+        qmi_hw->atrans[i] = atrans[i];
+
+    // Drop the cache lines fetched through the old mapping (invalidate by set/way)
+    for (uintptr_t offset = 0; offset < XIP_CACHE_BYTES; offset += XIP_CACHE_LINE)
+        *(volatile uint8_t *)(XIP_MAINTENANCE_BASE + offset) = 0;
+    __asm volatile("dsb; isb" ::: "memory");
+#else
+    (void)slot;
+#endif
+}
@@ -0,0 +1,44 @@
+/*
+ * app_slot.h
+ *
+ */
+
+#ifndef APP_SLOT_H
+#define APP_SLOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "pico.h"
+#include "config.h"
+
+// Images linked for the start of the application area can run from any slot
+// on RP2350 (address translation), on RP2040 only from slot 0
+#if PICO_RP2350 && SD_BOOT_APP_SLOTS > 1
+#define APP_SLOT_TRANSLATION 1
+#else
+#define APP_SLOT_TRANSLATION 0
+#endif
+
+// Flash offset of a slot
+static inline uint32_t app_slot_offset(int slot)
+{
+    return SD_BOOT_FLASH_OFFSET + (uint32_t)slot * SD_BOOT_APP_SLOT_SIZE;
+}
+
+// Slot whose flash range holds a flash offset, -1 if none does
+int app_slot_of_offset(uint32_t flash_offset);
+
+// Slot an image has been linked for, from its reset vector: a position
+// specific build for another slot has to be placed there, anything else is
+// linked for slot 0. Returns -1 if the vector is outside the slots.
+int app_slot_linked_for(const uint32_t *vectors);
+
+// Address of the vector table the application sees when launched from slot.
+uint32_t *app_slot_vector_table(int slot);
+
+// Map a slot holding an image linked for slot 0 over the start of the
+// application area (RP2350 only). Runs from RAM; call it last before the jump,
+// the loader's own flash is not mapped any more afterwards.
+void app_slot_map(int slot);
+
+#endif // APP_SLOT_H
@@ -0,0 +1,230 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * bench.c
+ *
+ * On-target benchmark firmware (picocalc_sd_boot_bench_<board>). It is
+ * flashed instead of the loader and runs the same suite on every boot:
+ *  - LCD: full screen draw_rect_spi fills, glyphs through
+ *    lcd_print_string_color, scroll_lcd_spi.
+ *  - SD: sequential fread throughput for several request sizes at each rate
+ *    of the SPI clock ladder, reading /sd/bench.dat (created on first run).
+ *  - Flash: sector erase, 64KB block erase and sector program times, in the
+ *    last 64KB of the flash (anything stored there is lost).
+ *
+ * Every result is one line on the UART:
+ *     BENCH <suite> <case> <value> <unit>
+ * so runs can be collected with grep and compared across releases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include <hardware/flash.h>
+#include "config.h"
+#include "lcdspi.h"
+#include "blockdevice/sd.h"
+#include "filesystem/fat.h"
+#include "filesystem/vfs.h"
+
+#define BENCH_FILE        "/sd/bench.dat"
+#define BENCH_FILE_SIZE   (1024 * 1024)
+#define BENCH_FLASH_BASE  (PICO_FLASH_SIZE_BYTES - FLASH_BLOCK_SIZE)
+#define LCD_FILLS         20
+#define LCD_GLYPH_LINES   40
+#define LCD_SCROLLS       50
+
+static const uint32_t sd_rates[] = {SD_SPI_BAUD_SAFE, SD_SPI_BAUD_LADDER};
+static const size_t read_sizes[] = {512, 4096, 16384, 65536};
+
+static void result(const char *suite, const char *name, double value, const char *unit)
+{
+    printf("BENCH %s %s %.3f %s\n", suite, name, value, unit);
+}
+
+static double seconds_since(uint64_t start)
+{
+    return (time_us_64() - start) / 1e6;
+}
+
+static void bench_lcd(void)
+{
+    uint64_t start = time_us_64();
+    for (int i = 0; i < LCD_FILLS; i++)
+        draw_rect_spi(0, 0, LCD_WIDTH - 1, LCD_HEIGHT - 1, (i & 1) ? WHITE : BLACK);
+    lcd_wait_idle();
+    double t = seconds_since(start);
+    result("lcd", "fill_fps", LCD_FILLS / t, "fps");
+    result("lcd", "fill_rate", LCD_FILLS * LCD_WIDTH * LCD_HEIGHT / t / 1e6, "Mpixel/s");
+
+    char line[LCD_WIDTH / 8 + 1];
+    for (size_t i = 0; i < sizeof(line) - 1; i++)
+        line[i] = ' ' + 1 + i % 94;
+    line[sizeof(line) - 1] = '\0';
+    start = time_us_64();
+    for (int i = 0; i < LCD_GLYPH_LINES; i++)
+    {
+        lcd_set_cursor(0, (i * 12) % (LCD_HEIGHT - 12));
+        lcd_print_string_color(line, WHITE, BLACK);
+    }
+    lcd_wait_idle();
+    result("lcd", "glyphs", LCD_GLYPH_LINES * (sizeof(line) - 1) / seconds_since(start), "glyph/s");
+
+    start = time_us_64();
+    for (int i = 0; i < LCD_SCROLLS; i++)
+        scroll_lcd_spi(12);
+    lcd_wait_idle();
+    result("lcd", "scroll_12_lines", seconds_since(start) * 1e6 / LCD_SCROLLS, "us");
+    lcd_set_scroll_area(0, 0);
+}
+
+static blockdevice_t *sd_mount(uint32_t rate, filesystem_t *fat)
+{
+    blockdevice_t *sd = blockdevice_sd_create(spi0, SD_MOSI_PIN, SD_MISO_PIN, SD_SCLK_PIN,
+                                              SD_CS_PIN, rate, true);
+    if (fs_mount("/sd", fat, sd) == -1)
+    {
+        blockdevice_sd_free(sd);
+        return NULL;
+    }
+    return sd;
+}
+
+// Write the test file unless it is there already
+static bool ensure_bench_file(uint8_t *buffer, size_t size)
+{
+    FILE *fp = fopen(BENCH_FILE, "r");
+    if (fp != NULL)
+    {
+        fseek(fp, 0, SEEK_END);
+        long len = ftell(fp);
+        fclose(fp);
+        if (len == BENCH_FILE_SIZE)
+            return true;
+    }
+
+    printf("BENCH info creating %s\n", BENCH_FILE);
+    fp = fopen(BENCH_FILE, "w");
+    if (fp == NULL)
+        return false;
+    for (size_t i = 0; i < size; i++)
+        buffer[i] = i * 7;
+    bool ok = true;
+    for (size_t done = 0; ok && done < BENCH_FILE_SIZE; done += size)
+        ok = fwrite(buffer, 1, size, fp) == size;
+    fclose(fp);
+    return ok;
+}
+
+static void bench_sd(void)
+{
+    size_t max = read_sizes[count_of(read_sizes) - 1];
+    uint8_t *buffer = malloc(max);
+    if (buffer == NULL)
+    {
+        printf("BENCH error sd out of memory\n");
+        return;
+    }
+
+    for (size_t r = 0; r < count_of(sd_rates); r++)
+    {
+        filesystem_t *fat = filesystem_fat_create();
+        blockdevice_t *sd = sd_mount(sd_rates[r], fat);
+        if (sd == NULL || (r == 0 && !ensure_bench_file(buffer, max)))
+        {
+            printf("BENCH error sd mount failed at %lu Hz\n", (unsigned long)sd_rates[r]);
+            if (sd != NULL)
+            {
+                fs_unmount("/sd");
+                blockdevice_sd_free(sd);
+            }
+            filesystem_fat_free(fat);
+            continue;
+        }
+
+        for (size_t i = 0; i < count_of(read_sizes); i++)
+        {
+            FILE *fp = fopen(BENCH_FILE, "r");
+            if (fp == NULL)
+                break;
+            size_t total = 0, len;
+            uint64_t start = time_us_64();
+            while ((len = fread(buffer, 1, read_sizes[i], fp)) > 0)
+                total += len;
+            double t = seconds_since(start);
+            fclose(fp);
+
+            char name[48];
+            snprintf(name, sizeof(name), "read_%luhz_%ub", (unsigned long)sd_rates[r], (unsigned)read_sizes[i]);
+            result("sd", name, total / t / 1e6, "MB/s");
+        }
+
+        fs_unmount("/sd");
+        blockdevice_sd_free(sd);
+        filesystem_fat_free(fat);
+    }
+    free(buffer);
+}
+
+static double __not_in_flash_func(time_flash_op)(uint32_t offset, bool erase, size_t len, const uint8_t *data)
+{
+    uint32_t ints = save_and_disable_interrupts();
+    uint64_t start = time_us_64();
+    if (erase)
+        flash_range_erase(offset, len);
+    else
+        flash_range_program(offset, data, len);
+    uint64_t end = time_us_64();
+    restore_interrupts(ints);
+    return (end - start) / 1e3;
+}
+
+static void bench_flash(void)
+{
+    static uint8_t data[FLASH_SECTOR_SIZE];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = i * 13;
+
+    const int sectors = FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE;
+    double erase_ms = 0, program_ms = 0;
+    for (int i = 0; i < sectors; i++)
+    {
+        uint32_t offset = BENCH_FLASH_BASE + i * FLASH_SECTOR_SIZE;
+        erase_ms += time_flash_op(offset, true, FLASH_SECTOR_SIZE, NULL);
+        program_ms += time_flash_op(offset, false, FLASH_SECTOR_SIZE, data);
+    }
+    result("flash", "sector_erase", erase_ms / sectors, "ms");
+    result("flash", "sector_program", program_ms / sectors, "ms");
+    result("flash", "block_erase_64k", time_flash_op(BENCH_FLASH_BASE, true, FLASH_BLOCK_SIZE, NULL), "ms");
+}
+
+int main()
+{
+    stdio_init_all();
+    uart_init(uart0, 115200);
+    uart_set_format(uart0, 8, 1, UART_PARITY_NONE);
+    uart_set_fifo_enabled(uart0, false);
+
+    // Give a terminal time to attach
+    sleep_ms(2000);
+    printf("BENCH begin clk_sys %lu Hz\n", (unsigned long)clock_get_hz(clk_sys));
+
+    lcd_init();
+    lcd_clear();
+    bench_lcd();
+    bench_sd();
+    bench_flash();
+
+    printf("BENCH end\n");
+    uart_tx_wait_blocking(uart0);
+    while (true)
+        tight_loop_contents();
+}
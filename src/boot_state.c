@@ -0,0 +1,272 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * boot_state.c
+ *
+ * Persistent loader state kept in a reserved flash sector just below the
+ * application area (SD_BOOT_STATE_OFFSET). The record is read in place
+ * through XIP and protected by a magic, a version and a checksum, so a
+ * missing, outdated or torn record simply reads as "no state".
+ *
+ * Besides the last launched path the record holds the slot table: for each
+ * application slot whether it holds a completely written image, with its
+ * length and digest and the path, size and modification time of the file it
+ * came from. The flash writer invalidates a slot before its first erase, and
+ * the loader records it again once the load has finished. Slots are reused in
+ * least recently launched order.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <hardware/flash.h>
+#include "config.h"
+#include "debug.h"
+#include "boot_state.h"
+
+#define BOOT_STATE_MAGIC   0x54534453 // "SDST"
+#define BOOT_STATE_VERSION 4
+
+typedef struct
+{
+    char path[256];       // File the image was loaded from
+    uint32_t file_size;   // Size and modification time of that file
+    uint32_t file_mtime;
+    uint32_t image_size;  // Size of the complete image in flash, 0 if none
+    image_hash_t image_hash;
+    uint32_t last_used;   // Launch sequence number, for LRU eviction
+} boot_slot_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    char last_path[256];
+    uint32_t last_slot;  // Slot of the last launched image
+    uint32_t sequence;   // Last launch sequence number handed out
+    boot_slot_t slots[SD_BOOT_APP_SLOTS];
+    uint32_t checksum;   // Must stay the last member
+} boot_state_t;
+
+_Static_assert(sizeof(boot_state_t) <= FLASH_SECTOR_SIZE, "too many slots for the state sector");
+
+// The record is programmed in whole flash pages
+typedef union
+{
+    boot_state_t state;
+    uint8_t bytes[(sizeof(boot_state_t) + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1)];
+} boot_state_page_t;
+
+// boot_state.ld fails the link if the loader reaches into the state sector
+_Static_assert(SD_BOOT_STATE_OFFSET == 0x3F000, "update the limit in boot_state.ld");
+
+// Record being prepared by the update functions
+static boot_state_page_t page;
+
+// FNV-1a over everything but the checksum itself
+static uint32_t state_checksum(const boot_state_t *state)
+{
+    const uint8_t *p = (const uint8_t *)state;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(boot_state_t, checksum); i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// The stored record, or NULL if there is none
+static const boot_state_t *stored_state(void)
+{
+    const boot_state_t *state = (const boot_state_t *)(XIP_BASE + SD_BOOT_STATE_OFFSET);
+    if (state->magic != BOOT_STATE_MAGIC || state->version != BOOT_STATE_VERSION)
+        return NULL;
+    if (state->checksum != state_checksum(state))
+        return NULL;
+    return state;
+}
+
+static bool valid_slot(int slot)
+{
+    return slot >= 0 && slot < SD_BOOT_APP_SLOTS;
+}
+
+static void __not_in_flash_func(write_state)(const boot_state_page_t *page)
+{
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(SD_BOOT_STATE_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(SD_BOOT_STATE_OFFSET, page->bytes, sizeof(page->bytes));
+    restore_interrupts(ints);
+}
+
+// Start an update from the stored record, or from an empty one
+static boot_state_t *begin_update(void)
+{
+    const boot_state_t *state = stored_state();
+    memset(&page, 0xFF, sizeof(page));
+    if (state != NULL)
+    {
+        page.state = *state;
+    }
+    else
+    {
+        memset(&page.state, 0, sizeof(page.state));
+        page.state.magic = BOOT_STATE_MAGIC;
+        page.state.version = BOOT_STATE_VERSION;
+    }
+    return &page.state;
+}
+
+// Store the updated record unless it matches the current one
+static void commit_update(void)
+{
+    page.state.checksum = state_checksum(&page.state);
+
+    const boot_state_t *state = stored_state();
+    if (state != NULL && memcmp(state, &page.state, sizeof(page.state)) == 0)
+        return;
+
+    DEBUG_PRINT("boot state: %s, slot %lu\n", page.state.last_path, (unsigned long)page.state.last_slot);
+    write_state(&page);
+}
+
+// Make a slot the last launched one
+static void mark_launched(boot_state_t *state, int slot)
+{
+    boot_slot_t *s = &state->slots[slot];
+    strcpy(state->last_path, s->path);
+    state->last_slot = slot;
+    if (s->last_used != state->sequence || s->last_used == 0)
+        s->last_used = ++state->sequence;
+}
+
+bool boot_state_get_last_path(char *path, size_t size)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL || state->last_path[0] == '\0')
+        return false;
+
+    strncpy(path, state->last_path, size - 1);
+    path[size - 1] = '\0';
+    return true;
+}
+
+int boot_state_get_last_slot(void)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL || !valid_slot(state->last_slot))
+        return 0;
+    return state->last_slot;
+}
+
+bool boot_state_get_image(int slot, boot_image_t *image)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL || !valid_slot(slot))
+        return false;
+
+    const boot_slot_t *s = &state->slots[slot];
+    if (s->image_size == 0 || s->image_size > SD_BOOT_APP_SLOT_SIZE)
+        return false;
+
+    image->file_size = s->file_size;
+    image->file_mtime = s->file_mtime;
+    image->image_size = s->image_size;
+    image->image_hash = s->image_hash;
+    return true;
+}
+
+int boot_state_find_image(const char *path, uint32_t file_size, uint32_t file_mtime)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL)
+        return -1;
+
+    for (int i = 0; i < SD_BOOT_APP_SLOTS; i++)
+    {
+        const boot_slot_t *s = &state->slots[i];
+        if (s->image_size != 0 && s->file_size == file_size && s->file_mtime == file_mtime &&
+            strcmp(s->path, path) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int boot_state_find_path(const char *path)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL || path[0] == '\0')
+        return -1;
+
+    for (int i = 0; i < SD_BOOT_APP_SLOTS; i++)
+    {
+        if (strcmp(state->slots[i].path, path) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int boot_state_lru_slot(void)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL)
+        return 0;
+
+    // An empty slot if there is one, else the least recently launched
+    int best = 0;
+    for (int i = 0; i < SD_BOOT_APP_SLOTS; i++)
+    {
+        const boot_slot_t *s = &state->slots[i];
+        if (s->image_size == 0)
+            return i;
+        if (s->last_used < state->slots[best].last_used)
+            best = i;
+    }
+    return best;
+}
+
+void boot_state_record_image(int slot, const char *path, const boot_image_t *image)
+{
+    if (!valid_slot(slot))
+        return;
+
+    boot_state_t *state = begin_update();
+    boot_slot_t *s = &state->slots[slot];
+    memset(s->path, 0, sizeof(s->path));
+    strncpy(s->path, path, sizeof(s->path) - 1);
+    s->file_size = image->file_size;
+    s->file_mtime = image->file_mtime;
+    s->image_size = image->image_size;
+    s->image_hash = image->image_hash;
+    s->last_used = 0;
+    mark_launched(state, slot);
+    commit_update();
+}
+
+void boot_state_record_launch(int slot)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL || !valid_slot(slot) || state->slots[slot].image_size == 0)
+        return;
+
+    mark_launched(begin_update(), slot);
+    commit_update();
+}
+
+void boot_state_invalidate_image(int slot)
+{
+    const boot_state_t *state = stored_state();
+    if (state == NULL || !valid_slot(slot) || state->slots[slot].image_size == 0)
+        return;
+
+    boot_slot_t *s = &begin_update()->slots[slot];
+    s->image_size = 0;
+    memset(&s->image_hash, 0xFF, sizeof(s->image_hash));
+    commit_update();
+}
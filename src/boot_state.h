@@ -0,0 +1,55 @@
+/*
+ * boot_state.h
+ *
+ */
+
+#ifndef BOOT_STATE_H
+#define BOOT_STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "image_hash.h"
+
+// Image resident in an application slot
+typedef struct
+{
+    uint32_t file_size;   // Size and modification time of the file it was loaded from
+    uint32_t file_mtime;
+    uint32_t image_size;  // Size of the image in flash
+    image_hash_t image_hash;
+} boot_image_t;
+
+// Copy the path of the last successfully launched firmware into path.
+// Returns false if no (intact) record exists.
+bool boot_state_get_last_path(char *path, size_t size);
+
+// Slot of the last launched firmware (0 if none was recorded).
+int boot_state_get_last_slot(void);
+
+// Get the completely written image in a slot. Returns false if no image was
+// recorded there or a later load into the slot was interrupted.
+bool boot_state_get_image(int slot, boot_image_t *image);
+
+// Find the slot holding the image loaded from a file with this path, size
+// and modification time. Returns -1 if it is not resident.
+int boot_state_find_image(const char *path, uint32_t file_size, uint32_t file_mtime);
+
+// Find the slot last loaded from a file with this path, whatever its version
+// and even if that load was interrupted. Returns -1 if there is none.
+int boot_state_find_path(const char *path);
+
+// Slot to load a new image into: an empty one, or the least recently launched.
+int boot_state_lru_slot(void);
+
+// Record a completely written image in a slot and the file it was loaded from,
+// as the one launched last. The state sector is only rewritten if the record changes.
+void boot_state_record_image(int slot, const char *path, const boot_image_t *image);
+
+// Record the launch of the image resident in a slot.
+void boot_state_record_launch(int slot);
+
+// Mark a slot as being modified (called before the first erase).
+void boot_state_invalidate_image(int slot);
+
+#endif // BOOT_STATE_H
@@ -0,0 +1,90 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * boot_trace.c
+ *
+ * Boot phase timing (SD_BOOT_TRACE). Checkpoints are time_us_64() stamps
+ * with a label, kept in a small static buffer together with a few counters
+ * (bytes read, sectors erased and programmed, SD retries). The report goes
+ * to DEBUG_PRINT when the UI is up and right before an application is
+ * launched, and is shown on the diagnostics screen (F1 in the file browser).
+ * Without SD_BOOT_TRACE nothing of this is compiled in.
+ */
+
+#include "config.h"
+
+#if SD_BOOT_TRACE
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "debug.h"
+#include "boot_trace.h"
+
+typedef struct
+{
+    const char *label;
+    uint64_t time_us;
+} checkpoint_t;
+
+static checkpoint_t checkpoints[SD_BOOT_TRACE_ENTRIES];
+static int checkpoint_count = 0;
+static uint32_t counters[TRACE_COUNTERS];
+
+static const char *const counter_names[TRACE_COUNTERS] = {
+    [TRACE_BYTES_READ] = "bytes read",
+    [TRACE_SECTORS_ERASED] = "sectors erased",
+    [TRACE_SECTORS_PROGRAMMED] = "sectors programmed",
+    [TRACE_SD_RETRIES] = "SD retries",
+};
+
+void boot_trace_mark(const char *label)
+{
+    // Later checkpoints are dropped once the buffer is full
+    if (checkpoint_count < SD_BOOT_TRACE_ENTRIES)
+    {
+        checkpoints[checkpoint_count].label = label;
+        checkpoints[checkpoint_count].time_us = time_us_64();
+        checkpoint_count++;
+    }
+}
+
+void boot_trace_add(boot_trace_counter_t counter, uint32_t n)
+{
+    counters[counter] += n;
+}
+
+bool boot_trace_line(int i, char *buf, size_t size)
+{
+    if (i < checkpoint_count)
+    {
+        // Time of the checkpoint and the time spent since the previous one
+        uint64_t t = checkpoints[i].time_us;
+        uint64_t prev = i > 0 ? checkpoints[i - 1].time_us : 0;
+        snprintf(buf, size, "%6lu.%lu +%5lu.%lu %s",
+                 (unsigned long)(t / 1000), (unsigned long)(t / 100 % 10),
+                 (unsigned long)((t - prev) / 1000), (unsigned long)((t - prev) / 100 % 10),
+                 checkpoints[i].label);
+        return true;
+    }
+
+    i -= checkpoint_count;
+    if (i < TRACE_COUNTERS)
+    {
+        snprintf(buf, size, "%13lu %s", (unsigned long)counters[i], counter_names[i]);
+        return true;
+    }
+    return false;
+}
+
+void boot_trace_report(void)
+{
+    char line[64];
+    DEBUG_PRINT("boot trace (ms, ms since the previous checkpoint):\n");
+    for (int i = 0; boot_trace_line(i, line, sizeof(line)); i++)
+        DEBUG_PRINT("  %s\n", line);
+}
+#endif
@@ -0,0 +1,46 @@
+/*
+ * boot_trace.h
+ *
+ */
+
+#ifndef BOOT_TRACE_H
+#define BOOT_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "config.h"
+
+// Counters kept next to the checkpoints
+typedef enum
+{
+    TRACE_BYTES_READ,         // Image bytes read from the card
+    TRACE_SECTORS_ERASED,     // Flash sectors erased
+    TRACE_SECTORS_PROGRAMMED, // Flash sectors programmed
+    TRACE_SD_RETRIES,         // Polls of a card that did not answer yet
+    TRACE_COUNTERS
+} boot_trace_counter_t;
+
+#if SD_BOOT_TRACE
+// Record a checkpoint: the time since reset, labelled (the label must be a literal).
+void boot_trace_mark(const char *label);
+
+// Add n to a counter.
+void boot_trace_add(boot_trace_counter_t counter, uint32_t n);
+
+// Print the checkpoints and counters with DEBUG_PRINT.
+void boot_trace_report(void);
+
+// Format line i of the report into buf. Returns false past the last line.
+bool boot_trace_line(int i, char *buf, size_t size);
+
+#define BOOT_TRACE_MARK(label)     boot_trace_mark(label)
+#define BOOT_TRACE_ADD(counter, n) boot_trace_add(counter, n)
+#define BOOT_TRACE_REPORT()        boot_trace_report()
+#else
+#define BOOT_TRACE_MARK(label)     ((void)0)
+#define BOOT_TRACE_ADD(counter, n) ((void)0)
+#define BOOT_TRACE_REPORT()        ((void)0)
+#endif
+
+#endif // BOOT_TRACE_H
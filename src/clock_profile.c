@@ -0,0 +1,73 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * clock_profile.c
+ *
+ * Optional performance profile (SD_BOOT_TURBO) for the time the loader runs.
+ * clk_sys is raised to SD_BOOT_TURBO_SYS_KHZ and clk_peri follows it, so the
+ * LCD and SD SPI clocks can be divided down from a faster source; the core
+ * voltage is raised first where the profile needs it. The frequencies and
+ * voltage found at start-up are kept and put back before launching, so an
+ * application starts in the same environment as without the profile.
+ */
+
+#include "config.h"
+#include "clock_profile.h"
+
+#if SD_BOOT_TURBO
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/vreg.h"
+
+static uint32_t default_sys_hz, default_peri_hz;
+static enum vreg_voltage default_voltage;
+static bool raised = false;
+
+static void set_clocks(uint32_t sys_hz, uint32_t peri_hz)
+{
+    set_sys_clock_hz(sys_hz, true);
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS, sys_hz, peri_hz);
+}
+
+void clock_profile_turbo(void)
+{
+    default_sys_hz = clock_get_hz(clk_sys);
+    default_peri_hz = clock_get_hz(clk_peri);
+    default_voltage = vreg_get_voltage();
+
+    if (SD_BOOT_TURBO_VREG > default_voltage)
+    {
+        vreg_set_voltage(SD_BOOT_TURBO_VREG);
+        // Let the regulator settle before the clock goes up
+        busy_wait_us(SD_BOOT_TURBO_VREG_SETTLE_US);
+    }
+    set_clocks(SD_BOOT_TURBO_SYS_KHZ * 1000, SD_BOOT_TURBO_SYS_KHZ * 1000);
+    raised = true;
+}
+
+void clock_profile_restore(void)
+{
+    if (!raised)
+        return;
+    set_clocks(default_sys_hz, default_peri_hz);
+    if (vreg_get_voltage() != default_voltage)
+    {
+        vreg_set_voltage(default_voltage);
+        busy_wait_us(SD_BOOT_TURBO_VREG_SETTLE_US);
+    }
+    raised = false;
+}
+#else
+void clock_profile_turbo(void)
+{
+}
+
+void clock_profile_restore(void)
+{
+}
+#endif
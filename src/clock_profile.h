@@ -0,0 +1,20 @@
+/*
+ * clock_profile.h
+ *
+ */
+
+#ifndef CLOCK_PROFILE_H
+#define CLOCK_PROFILE_H
+
+#include "config.h"
+
+// Raise clk_sys and clk_peri to the SD_BOOT_TURBO profile (no-op without
+// SD_BOOT_TURBO). Must run before any peripheral is set up, their dividers
+// are computed from the clocks at init.
+void clock_profile_turbo(void);
+
+// Put the clocks and core voltage back the way they were before
+// clock_profile_turbo(). Called right before an application is started.
+void clock_profile_restore(void);
+
+#endif // CLOCK_PROFILE_H
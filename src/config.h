@@ -9,6 +9,37 @@
 #define SD_CS_PIN       17
 #define SD_DET_PIN 22
 
+// SD card SPI clock. Set SD_SPI_BAUDRATE to a fixed rate in Hz to skip the
+// negotiation. With 0, fs_init() tries the SD_SPI_BAUD_LADDER rates from the
+// fastest down and keeps the first one that reads the FAT boot sector back
+// SD_SPI_VERIFY_READS times, identical to a read at SD_SPI_BAUD_SAFE.
+// The SPI block tops out at clk_peri / 2, faster entries are clamped.
+#ifndef SD_SPI_BAUDRATE
+#define SD_SPI_BAUDRATE     0
+#endif
+#ifndef SD_SPI_BAUD_SAFE
+#define SD_SPI_BAUD_SAFE    (125000000 / 2 / 4) // 15.6MHz
+#endif
+#ifndef SD_SPI_BAUD_LADDER
+#define SD_SPI_BAUD_LADDER  50000000, 41666666, 31250000, 25000000, 20833333
+#endif
+#ifndef SD_SPI_VERIFY_READS
+#define SD_SPI_VERIFY_READS 4
+#endif
+
+// SD card readiness. fs_init() retries opening the card, starting with a
+// SD_READY_RETRY_MS backoff, until it answers or SD_READY_TIMEOUT_MS passes.
+// SD_STABILIZE_MS adds a fixed delay before the first attempt (0 = none).
+#ifndef SD_READY_RETRY_MS
+#define SD_READY_RETRY_MS   10
+#endif
+#ifndef SD_READY_TIMEOUT_MS
+#define SD_READY_TIMEOUT_MS 2000
+#endif
+#ifndef SD_STABILIZE_MS
+#define SD_STABILIZE_MS     0
+#endif
+
 #define LCD_SPI1    1
 #define LCD_SCK_PIN 10
 #define LCD_MOSI_PIN 11
@@ -38,8 +69,173 @@
 // when loading a new application from the SD card
 #define SD_BOOT_FLASH_OFFSET         (256 * 1024)
 
+// The last sector below the application area holds the loader's persistent
+// state (last launched firmware). The loader binary must end below it.
+#define SD_BOOT_STATE_OFFSET         (SD_BOOT_FLASH_OFFSET - FLASH_SECTOR_SIZE)
+
 // Maximum size of the application that can be loaded
 // This ensures we don't overwrite the bootloader itself
 #define MAX_APP_SIZE                 (PICO_FLASH_SIZE_BYTES - SD_BOOT_FLASH_OFFSET)
 
+// Application slots: the application area can be divided into several
+// slots that keep their images resident, so switching between a few apps
+// needs neither an SD read nor a reflash. The least recently launched slot is
+// reused for a new image. On RP2350 images are mapped from their slot with
+// the address translation; on RP2040 apps built for the application area
+// always use slot 0, the other slots are only used by builds linked for them.
+#ifndef SD_BOOT_APP_SLOTS
+#define SD_BOOT_APP_SLOTS            1
+#endif
+#ifndef SD_BOOT_APP_SLOT_SIZE
+#define SD_BOOT_APP_SLOT_SIZE        ((MAX_APP_SIZE / SD_BOOT_APP_SLOTS) & ~(FLASH_SECTOR_SIZE - 1))
+#endif
+
+// Images linked to run from SRAM (PICO_NO_FLASH / no_flash builds, with the
+// reset vector in SRAM) are read into RAM and started from there, without
+// any flash erase or program. They are limited by the free SRAM: 256KB on
+// RP2040 and 512KB on RP2350, less what the loader itself uses. Only plain
+// .bin files are supported for this.
+#ifndef SD_BOOT_RAM_LAUNCH
+#define SD_BOOT_RAM_LAUNCH           1
+#endif
+
+// Differential flashing: compare each sector with the current flash content
+// and only erase/program the sectors that changed. Set to 0 to always
+// rewrite the whole image.
+#ifndef SD_BOOT_DIFF_FLASH
+#define SD_BOOT_DIFF_FLASH           1
+#endif
+
+// Size of the staging buffer used while loading an application. The image
+// is read from SD in requests of this size, then flushed to flash. It is
+// allocated only while loading and shrinks automatically if RAM is short.
+#ifndef SD_BOOT_LOAD_BUFFER_SIZE
+#define SD_BOOT_LOAD_BUFFER_SIZE     (64 * 1024)
+#endif
+
+// Number of changed sectors in a 64KB aligned block from which the whole
+// block is erased at once instead of sector by sector. A block erase costs
+// about as much as a few sector erases on the QSPI parts used by Pico/Pico 2.
+// Block erases need a staging buffer of at least 64KB.
+#ifndef SD_BOOT_BLOCK_ERASE_MIN_DIRTY
+#define SD_BOOT_BLOCK_ERASE_MIN_DIRTY 6
+#endif
+
+// Auto-boot: on power-up, launch the last successfully launched firmware
+// again unless a key is pressed within SD_BOOT_AUTOBOOT_WINDOW_MS.
+#ifndef SD_BOOT_AUTOBOOT
+#define SD_BOOT_AUTOBOOT             1
+#endif
+#ifndef SD_BOOT_AUTOBOOT_WINDOW_MS
+#define SD_BOOT_AUTOBOOT_WINDOW_MS   300
+#endif
+
+// Fast launch: if the application in flash was written completely and has a
+// valid vector table, start it right away, before the LCD and the SD card are
+// initialised. A key held down at power-up shows the menu: it is launched as
+// soon as two keyboard polls (about 22 ms each) reported no key, at the latest
+// after SD_BOOT_FAST_LAUNCH_WINDOW_MS.
+// Note that an updated file on the SD card is then only picked up from the menu.
+#ifndef SD_BOOT_FAST_LAUNCH
+#define SD_BOOT_FAST_LAUNCH          1
+#endif
+#ifndef SD_BOOT_FAST_LAUNCH_WINDOW_MS
+#define SD_BOOT_FAST_LAUNCH_WINDOW_MS 60
+#endif
+
+// Number of directory listings kept in RAM, so going back to a directory
+// that was visited before does not read it from the card again
+#ifndef SD_BOOT_DIR_CACHE_SLOTS
+#define SD_BOOT_DIR_CACHE_SLOTS      4
+#endif
+
+// Directories are read incrementally: the visible rows plus
+// SD_BOOT_DIR_READAHEAD entries when a folder is opened or the cursor moves,
+// the rest SD_BOOT_DIR_IDLE_BATCH entries at a time while the UI is idle.
+#ifndef SD_BOOT_DIR_READAHEAD
+#define SD_BOOT_DIR_READAHEAD        8
+#endif
+#ifndef SD_BOOT_DIR_IDLE_BATCH
+#define SD_BOOT_DIR_IDLE_BATCH       4
+#endif
+
+// Read size for compressed (.bin.lz4) images. The decompressor needs no
+// other buffer than this one and the flash writer's staging buffer.
+#ifndef SD_BOOT_LZ4_INPUT_SIZE
+#define SD_BOOT_LZ4_INPUT_SIZE       4096
+#endif
+
+// List only directories and firmware images (.bin, .bin.lz4, .uf2) in the
+// file browser. TAB switches between this and listing all files.
+#ifndef SD_BOOT_FIRMWARE_ONLY
+#define SD_BOOT_FIRMWARE_ONLY        0
+#endif
+
+// Boot phase timing: checkpoints and load counters, reported over UART
+// (with ENABLE_DEBUG) and on a diagnostics screen opened with F1 in the file
+// browser. Compiled out completely when 0.
+#ifndef SD_BOOT_TRACE
+#define SD_BOOT_TRACE                0
+#endif
+#ifndef SD_BOOT_TRACE_ENTRIES
+#define SD_BOOT_TRACE_ENTRIES        24
+#endif
+
+// Performance profile while the loader runs: clk_sys and clk_peri at
+// SD_BOOT_TURBO_SYS_KHZ, the LCD SPI at up to SD_BOOT_TURBO_LCD_SPI_SPEED,
+// and the SD ladder rates reachable from the faster clk_peri. The clocks and
+// core voltage are restored before an application is launched. On RP2040,
+// 200MHz needs 1.15V; flash then runs at 100MHz with the default boot2
+// divider, which the PicoCalc's W25Q flash supports.
+#ifndef SD_BOOT_TURBO
+#define SD_BOOT_TURBO                0
+#endif
+#ifndef SD_BOOT_TURBO_SYS_KHZ
+#define SD_BOOT_TURBO_SYS_KHZ        200000
+#endif
+#ifndef SD_BOOT_TURBO_VREG
+#if PICO_RP2040
+#define SD_BOOT_TURBO_VREG           VREG_VOLTAGE_1_15
+#else
+#define SD_BOOT_TURBO_VREG           VREG_VOLTAGE_DEFAULT
+#endif
+#endif
+#ifndef SD_BOOT_TURBO_VREG_SETTLE_US
+#define SD_BOOT_TURBO_VREG_SETTLE_US 1000
+#endif
+#ifndef SD_BOOT_TURBO_LCD_SPI_SPEED
+#define SD_BOOT_TURBO_LCD_SPI_SPEED  40000000
+#endif
+
+// Bring the LCD up on core1 while core0 mounts the card and reads the root
+// directory (SPI1 and SPI0 are independent). Core1 is put back into reset as
+// soon as the panel is ready.
+#ifndef SD_BOOT_PARALLEL_INIT
+#define SD_BOOT_PARALLEL_INIT        1
+#endif
+
+// Readahead under the FAT layer (sd_readahead.c): reads that continue a
+// sequential stream fetch a whole FAT cluster, at most this many bytes, with
+// one multi-block read. 0 reads the card directly.
+#ifndef SD_BOOT_READAHEAD_SIZE
+#define SD_BOOT_READAHEAD_SIZE       (32 * 1024)
+#endif
+
+// Catalog of complete directory listings on the card, so the file browser
+// is painted without walking the directory and then revalidated in idle time.
+// Off by default since it writes to the card; the directory is created if it
+// does not exist.
+#ifndef SD_BOOT_CATALOG
+#define SD_BOOT_CATALOG              0
+#endif
+#ifndef SD_BOOT_CATALOG_DIR
+#define SD_BOOT_CATALOG_DIR          "/sd/sd_boot"
+#endif
+#ifndef SD_BOOT_CATALOG_PATH
+#define SD_BOOT_CATALOG_PATH         SD_BOOT_CATALOG_DIR "/.catalog"
+#endif
+#ifndef SD_BOOT_CATALOG_MAX_DIRS
+#define SD_BOOT_CATALOG_MAX_DIRS     16
+#endif
+
 #endif // CONFIG_H
@@ -0,0 +1,919 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * dir_listing.c
+ *
+ * Cached directory listings for the Text Directory UI.
+ *
+ * The listings of the last few directories are kept in RAM, keyed by path,
+ * together with the entry that was selected in them, so navigating back is
+ * instant. Entries are taken from readdir() alone when d_type is known; file
+ * sizes are fetched with stat() only for entries that are displayed.
+ *
+ * A listing is stored compactly: the names are packed one after the other in
+ * a string pool and each entry is a small fixed-size record pointing into it.
+ * Both grow with the directory, so there is no limit on the number of entries.
+ *
+ * Directories are enumerated incrementally: opening one reads nothing, the UI
+ * asks for the entries it is about to show (dir_listing_fill()) and the rest
+ * is read in idle time (dir_listing_read_ahead()), with the directory kept
+ * open in between. Opening a folder therefore takes the same time whatever
+ * its size, and moving further down only reads the entries not read yet.
+ * Only the current listing can be incomplete; it is dropped when another
+ * directory is opened before it was read to the end.
+ *
+ * Listings are kept sorted, directories first and then by name ignoring case.
+ * Each entry read is inserted at its place with a binary search over the
+ * 12-byte index records; the remembered selection moves along with inserts
+ * before it so it keeps pointing at the same entry.
+ *
+ * Firmware images (.bin) are checked before they can be selected: the first
+ * 8 bytes must hold a plausible stack pointer and reset vector, the same
+ * check is_valid_application() applies to the flash. For compressed images
+ * (.bin.lz4) these are decompressed from the start of the frame and the
+ * size limit applies to the size in the frame header. UF2 images (.uf2)
+ * are checked on their first block for this chip, which must be at the start
+ * of the application area. With SD_BOOT_RAM_LAUNCH, plain images linked to
+ * run from SRAM are valid as well if they fit. This happens when the
+ * entry is displayed, together with fetching its size, and for the remaining
+ * entries in idle time once the directory is read. In firmware-only mode
+ * other files are not listed at all.
+ *
+ * With SD_BOOT_CATALOG, complete listings are also kept on the card in
+ * SD_BOOT_CATALOG_PATH, a sequence of packed blocks: a header with the
+ * directory path, the index records (with each file's size, modification
+ * time and image state) and the string pool, stored just as they are in RAM,
+ * plus a checksum. A directory found there is painted from it straight away.
+ * FAT does not keep directory times up to date, so the catalog is revalidated
+ * lazily instead: in idle time the directory is read again and its names are
+ * compared with the catalog (the listing is rebuilt if they differ), then each
+ * file is stat()ed and an image whose size or time changed is checked again.
+ * Changed listings are written back once they are complete. The sizes and
+ * times are also what the boot state records for resident images, so
+ * "already in flash" is known per entry without reading the images.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include "pico/stdlib.h"
+#include "config.h"
+#include "debug.h"
+#include "dir_listing.h"
+#include "lz4_image.h"
+#include "uf2_image.h"
+#include "boot_state.h"
+
+#define SIZE_UNKNOWN UINT32_MAX
+
+// External function for checking a vector table
+extern bool is_valid_application(uint32_t *app_location);
+extern bool is_ram_application(const uint32_t *vectors, uint32_t size);
+
+// Index record of one directory entry
+typedef struct
+{
+    uint32_t name : 24;  // Offset of the name in the string pool
+    uint32_t is_dir : 1; // 1 if directory, 0 if file
+    uint32_t image : 2;  // dir_image_state_t
+    uint32_t stale : 1;  // Taken from the catalog, not compared with the file yet
+    uint32_t size;       // Size of the file in bytes, SIZE_UNKNOWN until it is needed
+    uint32_t mtime;      // Modification time of a checked image, 0 if unknown
+} entry_t;
+
+typedef struct
+{
+    char path[512];      // Empty for an unused slot
+    DIR *dir;            // Open while the directory has not been read to the end
+    entry_t *entries;
+    int count;
+    int capacity;
+    char *names;         // String pool
+    size_t names_used;
+    size_t names_size;
+    int selected;
+    char search[32];     // Prefix typed before the listing was complete
+    int next_check;      // Next entry to check in idle time
+    uint32_t last_used; // For replacing the least recently used listing
+    bool verifying;      // Loaded from the catalog, dir is read to compare the names
+    bool changed;        // A name read while verifying is not in the listing
+    int verified;        // Names found while verifying
+    bool dirty;          // Differs from the catalog
+} listing_t;
+
+static listing_t cache[SD_BOOT_DIR_CACHE_SLOTS];
+static listing_t *current = NULL;
+static uint32_t use_counter = 0;
+static bool firmware_only = SD_BOOT_FIRMWARE_ONLY;
+
+static bool is_firmware_name(const char *name)
+{
+    const char *extension = ".bin";
+    size_t len = strlen(name), ext_len = strlen(extension);
+    return (len >= ext_len && strcmp(name + len - ext_len, extension) == 0) || lz4_image_is_name(name) ||
+           uf2_image_is_name(name);
+}
+
+static void free_listing(listing_t *l)
+{
+    if (l->dir)
+        closedir(l->dir);
+    free(l->entries);
+    free(l->names);
+    memset(l, 0, sizeof(*l));
+}
+
+// Listing order: directories first, then by name ignoring case
+static int compare_entry(const listing_t *l, const entry_t *e, const char *name, int is_dir)
+{
+    return (e->is_dir != is_dir) ? (is_dir ? 1 : -1) : strcasecmp(l->names + e->name, name);
+}
+
+// Index after the last entry that sorts at or before name
+static int insert_position(const listing_t *l, const char *name, int is_dir)
+{
+    int lo = 0, hi = l->count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (compare_entry(l, &l->entries[mid], name, is_dir) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Whether the listing holds an entry with exactly this name
+static bool has_entry(const listing_t *l, const char *name, int is_dir)
+{
+    // Names equal ignoring case sort next to each other
+    for (int i = insert_position(l, name, is_dir) - 1; i >= 0; i--)
+    {
+        const entry_t *e = &l->entries[i];
+        if (compare_entry(l, e, name, is_dir) != 0)
+            break;
+        if (strcmp(l->names + e->name, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool add_entry(listing_t *l, const char *name, int is_dir, uint32_t size)
+{
+    size_t len = strlen(name) + 1;
+    if (l->names_used + len > (1u << 24))
+        return false;
+
+    if (l->count == l->capacity)
+    {
+        int capacity = l->capacity ? l->capacity * 2 : 32;
+        entry_t *entries = realloc(l->entries, capacity * sizeof(entry_t));
+        if (entries == NULL)
+            return false;
+        l->entries = entries;
+        l->capacity = capacity;
+    }
+    if (l->names_used + len > l->names_size)
+    {
+        size_t names_size = l->names_size ? l->names_size * 2 : 512;
+        while (names_size < l->names_used + len)
+            names_size *= 2;
+        char *names = realloc(l->names, names_size);
+        if (names == NULL)
+            return false;
+        l->names = names;
+        l->names_size = names_size;
+    }
+
+    // Sorted insert
+    int lo = insert_position(l, name, is_dir);
+    memmove(&l->entries[lo + 1], &l->entries[lo], (l->count - lo) * sizeof(entry_t));
+    if (lo <= l->selected && l->selected < l->count)
+        l->selected++;
+    l->count++;
+
+    entry_t *entry = &l->entries[lo];
+    entry->name = l->names_used;
+    entry->is_dir = is_dir;
+    entry->image = (!is_dir && is_firmware_name(name)) ? DIR_IMAGE_UNKNOWN : DIR_IMAGE_NONE;
+    entry->stale = 0;
+    entry->size = size;
+    entry->mtime = 0;
+    memcpy(l->names + l->names_used, name, len);
+    l->names_used += len;
+    l->dirty = true;
+    return true;
+}
+
+// Throw away the entries of a listing to read its directory again
+static void clear_entries(listing_t *l)
+{
+    free(l->entries);
+    free(l->names);
+    l->entries = NULL;
+    l->names = NULL;
+    l->count = l->capacity = 0;
+    l->names_used = l->names_size = 0;
+    l->next_check = 0;
+    l->dirty = true;
+}
+
+// End of the directory while verifying a catalog listing: keep it if every
+// name was found, or start over reading the directory
+static void end_verify(listing_t *l)
+{
+    l->verifying = false;
+    closedir(l->dir);
+    l->dir = NULL;
+    if (!l->changed && l->verified == l->count)
+        return;
+
+    DEBUG_PRINT("dir listing: catalog out of date for %s\n", l->path);
+    clear_entries(l);
+    l->dir = opendir(l->path);
+}
+
+// Read up to max further entries of the current listing
+static int read_entries(listing_t *l, int max)
+{
+    int added = 0;
+    struct dirent *ent;
+    while (l->dir != NULL && added < max)
+    {
+        if ((ent = readdir(l->dir)) == NULL)
+        {
+            if (l->verifying)
+            {
+                end_verify(l);
+                added = 0;
+                continue;
+            }
+            closedir(l->dir);
+            l->dir = NULL;
+            DEBUG_PRINT("dir listing: %d entries, %u name bytes in %s\n", l->count, (unsigned)l->names_used, l->path);
+            break;
+        }
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+
+        int is_dir;
+        uint32_t size;
+        if (ent->d_type != DT_UNKNOWN)
+        {
+            // The size is fetched when the entry is displayed
+            is_dir = (ent->d_type == DT_DIR) ? 1 : 0;
+            size = is_dir ? 0 : SIZE_UNKNOWN;
+        }
+        else
+        {
+            // Build full path for stat
+            char full_path[768];
+            snprintf(full_path, sizeof(full_path), "%s/%s", l->path, ent->d_name);
+            struct stat statbuf;
+            if (stat(full_path, &statbuf) == 0)
+            {
+                is_dir = S_ISDIR(statbuf.st_mode) ? 1 : 0;
+                size = is_dir ? 0 : statbuf.st_size;
+            }
+            else
+            {
+                is_dir = 0;
+                size = 0;
+            }
+        }
+
+        if (firmware_only && !is_dir && !is_firmware_name(ent->d_name))
+            continue;
+
+        if (l->verifying)
+        {
+            // Compare only; the entries are already there
+            if (has_entry(l, ent->d_name, is_dir))
+                l->verified++;
+            else
+                l->changed = true;
+            added++;
+            continue;
+        }
+
+        if (!add_entry(l, ent->d_name, is_dir, size))
+        {
+            // Keep what fits; the listing is treated as complete
+            DEBUG_PRINT("dir listing: out of memory\n");
+            closedir(l->dir);
+            l->dir = NULL;
+            break;
+        }
+        added++;
+    }
+    return added;
+}
+
+#if SD_BOOT_CATALOG
+#define CATALOG_MAGIC   0x4C544143u // "CATL"
+#define CATALOG_VERSION 1
+#define CATALOG_TEMP    SD_BOOT_CATALOG_PATH ".tmp"
+
+// Block header; followed by the path, the index records and the string pool
+typedef struct
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t firmware_only; // Listing of firmware images only
+    uint16_t path_len;
+    uint32_t count;        // Index records
+    uint32_t names_used;   // Bytes of the string pool
+    uint32_t checksum;     // FNV-1a over path, records and pool
+} catalog_header_t;
+
+static bool catalog_dir_checked = false;
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len-- > 0)
+        hash = (hash ^ *p++) * 16777619u;
+    return hash;
+}
+
+static uint32_t block_checksum(const char *path, const entry_t *entries, uint32_t count,
+                               const char *names, uint32_t names_used)
+{
+    uint32_t hash = fnv1a(2166136261u, path, strlen(path));
+    hash = fnv1a(hash, entries, count * sizeof(entry_t));
+    return fnv1a(hash, names, names_used);
+}
+
+static long block_size(const catalog_header_t *h)
+{
+    return h->path_len + (long)h->count * sizeof(entry_t) + h->names_used;
+}
+
+static long file_length(FILE *fp)
+{
+    if (fseek(fp, 0, SEEK_END) != 0)
+        return -1;
+    long len = ftell(fp);
+    return fseek(fp, 0, SEEK_SET) == 0 ? len : -1;
+}
+
+// Read the header of the next block; false at the end or on a damaged file.
+// Every name takes at least its terminator in the pool, which bounds count,
+// and the block must fit in the rest of the file of file_len bytes.
+static bool read_header(FILE *fp, catalog_header_t *h, long file_len)
+{
+    return fread(h, 1, sizeof(*h), fp) == sizeof(*h) && h->magic == CATALOG_MAGIC &&
+           h->version == CATALOG_VERSION && h->path_len < sizeof(((listing_t *)0)->path) &&
+           h->names_used < (1u << 24) && h->count <= h->names_used &&
+           block_size(h) <= file_len - ftell(fp);
+}
+
+// Every name offset must start a terminated string inside the pool
+static bool names_valid(const entry_t *entries, uint32_t count, const char *names, uint32_t names_used)
+{
+    if (names_used > 0 && names[names_used - 1] != '\0')
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (entries[i].name >= names_used)
+            return false;
+    }
+    return true;
+}
+
+// Fill an empty listing slot with the catalog's listing of path. The files
+// in it are marked stale, to be compared with the card in idle time.
+static bool catalog_load(listing_t *l, const char *path)
+{
+    FILE *fp = fopen(SD_BOOT_CATALOG_PATH, "rb");
+    if (fp == NULL)
+        return false;
+
+    bool loaded = false;
+    long file_len = file_length(fp);
+    catalog_header_t h;
+    char block_path[sizeof(l->path)];
+    while (read_header(fp, &h, file_len))
+    {
+        if (fread(block_path, 1, h.path_len, fp) != h.path_len)
+            break;
+        block_path[h.path_len] = '\0';
+        long rest = block_size(&h) - h.path_len;
+        if (strcmp(block_path, path) != 0 || h.firmware_only != firmware_only)
+        {
+            if (fseek(fp, rest, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+
+        entry_t *entries = malloc(h.count > 0 ? h.count * sizeof(entry_t) : 1);
+        char *names = malloc(h.names_used > 0 ? h.names_used : 1);
+        if (entries != NULL && names != NULL &&
+            fread(entries, sizeof(entry_t), h.count, fp) == h.count &&
+            fread(names, 1, h.names_used, fp) == h.names_used &&
+            block_checksum(path, entries, h.count, names, h.names_used) == h.checksum &&
+            names_valid(entries, h.count, names, h.names_used))
+        {
+            for (uint32_t i = 0; i < h.count; i++)
+                entries[i].stale = !entries[i].is_dir;
+            l->entries = entries;
+            l->names = names;
+            l->count = l->capacity = h.count;
+            l->names_used = l->names_size = h.names_used;
+            loaded = true;
+        }
+        else
+        {
+            free(entries);
+            free(names);
+        }
+        break;
+    }
+    fclose(fp);
+    if (loaded)
+        DEBUG_PRINT("dir listing: %d entries of %s from the catalog\n", l->count, path);
+    return loaded;
+}
+
+static bool write_block(FILE *fp, const catalog_header_t *h, const char *path, const entry_t *entries,
+                        const char *names)
+{
+    return fwrite(h, 1, sizeof(*h), fp) == sizeof(*h) &&
+           fwrite(path, 1, h->path_len, fp) == h->path_len &&
+           fwrite(entries, sizeof(entry_t), h->count, fp) == h->count &&
+           fwrite(names, 1, h->names_used, fp) == h->names_used;
+}
+
+static bool is_saved(const listing_t *l, const char *path, bool fw_only)
+{
+    return fw_only == firmware_only && strcmp(l->path, path) == 0;
+}
+
+// Whether a cached listing is complete and fully checked
+static bool is_settled(const listing_t *l)
+{
+    return l->path[0] != '\0' && l->dir == NULL && l->next_check >= l->count;
+}
+
+// Write the settled cached listings, then the other blocks of the old
+// catalog, up to SD_BOOT_CATALOG_MAX_DIRS, to a new catalog
+static void catalog_save(void)
+{
+    FILE *out = fopen(CATALOG_TEMP, "wb");
+    if (out == NULL)
+    {
+        DEBUG_PRINT("catalog: cannot write %s\n", CATALOG_TEMP);
+        return;
+    }
+
+    bool ok = true;
+    int blocks = 0;
+    for (int i = 0; ok && i < SD_BOOT_DIR_CACHE_SLOTS && blocks < SD_BOOT_CATALOG_MAX_DIRS; i++)
+    {
+        listing_t *l = &cache[i];
+        if (!is_settled(l))
+            continue;
+        catalog_header_t h = {
+            .magic = CATALOG_MAGIC,
+            .version = CATALOG_VERSION,
+            .firmware_only = firmware_only,
+            .path_len = strlen(l->path),
+            .count = l->count,
+            .names_used = l->names_used,
+            .checksum = block_checksum(l->path, l->entries, l->count, l->names, l->names_used),
+        };
+        ok = write_block(out, &h, l->path, l->entries, l->names);
+        blocks++;
+    }
+
+    // Keep the blocks of directories that are not cached
+    FILE *in = fopen(SD_BOOT_CATALOG_PATH, "rb");
+    long in_len = in != NULL ? file_length(in) : -1;
+    catalog_header_t h;
+    char path[sizeof(((listing_t *)0)->path)];
+    while (ok && in != NULL && blocks < SD_BOOT_CATALOG_MAX_DIRS && read_header(in, &h, in_len))
+    {
+        if (fread(path, 1, h.path_len, in) != h.path_len)
+            break;
+        path[h.path_len] = '\0';
+        long rest = block_size(&h) - h.path_len;
+        bool cached = false;
+        for (int i = 0; i < SD_BOOT_DIR_CACHE_SLOTS; i++)
+            cached |= is_settled(&cache[i]) && is_saved(&cache[i], path, h.firmware_only);
+        if (cached)
+        {
+            if (fseek(in, rest, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+
+        uint8_t *data = malloc(rest > 0 ? rest : 1);
+        if (data == NULL || fread(data, 1, rest, in) != (size_t)rest)
+        {
+            free(data);
+            break;
+        }
+        const entry_t *entries = (const entry_t *)data;
+        const char *names = (const char *)data + h.count * sizeof(entry_t);
+        ok = write_block(out, &h, path, entries, names);
+        free(data);
+        blocks++;
+    }
+    if (in != NULL)
+        fclose(in);
+    ok = (fclose(out) == 0) && ok;
+
+    // FAT cannot rename over an existing file
+    if (ok)
+    {
+        remove(SD_BOOT_CATALOG_PATH);
+        ok = rename(CATALOG_TEMP, SD_BOOT_CATALOG_PATH) == 0;
+    }
+    if (!ok)
+    {
+        DEBUG_PRINT("catalog: write failed\n");
+        remove(CATALOG_TEMP);
+        return;
+    }
+    for (int i = 0; i < SD_BOOT_DIR_CACHE_SLOTS; i++)
+    {
+        if (is_settled(&cache[i]))
+            cache[i].dirty = false;
+    }
+    DEBUG_PRINT("catalog: %d listings written\n", blocks);
+}
+
+// The catalog's directory is created before the first listing is read, so
+// that listing already shows it
+static void catalog_prepare(void)
+{
+    if (catalog_dir_checked)
+        return;
+    catalog_dir_checked = true;
+    struct stat statbuf;
+    if (stat(SD_BOOT_CATALOG_DIR, &statbuf) != 0)
+        mkdir(SD_BOOT_CATALOG_DIR, 0777);
+}
+#endif
+
+bool dir_listing_open(const char *path)
+{
+    listing_t *slot = NULL;
+
+    if (current != NULL && strcmp(current->path, path) != 0 && current->verifying)
+    {
+        // Left before it was verified: keep the catalog's listing as it is
+        closedir(current->dir);
+        current->dir = NULL;
+        current->verifying = false;
+    }
+    else if (current != NULL && strcmp(current->path, path) != 0 && current->dir != NULL)
+    {
+        // Only the current listing may be incomplete
+        free_listing(current);
+        current = NULL;
+    }
+
+    for (int i = 0; i < SD_BOOT_DIR_CACHE_SLOTS; i++)
+    {
+        if (cache[i].path[0] != '\0' && strcmp(cache[i].path, path) == 0)
+        {
+            current = &cache[i];
+            current->last_used = ++use_counter;
+            current->search[0] = '\0';
+            return true;
+        }
+        // Prefer a free slot, otherwise the least recently used one
+        if (slot == NULL || (slot->path[0] != '\0' &&
+                             (cache[i].path[0] == '\0' || cache[i].last_used < slot->last_used)))
+            slot = &cache[i];
+    }
+
+    free_listing(slot);
+    current = NULL;
+#if SD_BOOT_CATALOG
+    catalog_prepare();
+#endif
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return false;
+
+    strncpy(slot->path, path, sizeof(slot->path) - 1);
+    slot->dir = dir;
+    slot->last_used = ++use_counter;
+#if SD_BOOT_CATALOG
+    // The directory stays open to compare it with the catalog in idle time
+    slot->verifying = catalog_load(slot, path);
+#endif
+    current = slot;
+    return true;
+}
+
+static int search_entries(const char *prefix);
+
+// Read further entries of the current listing and move the selection to a
+// better match for a pending search, see dir_listing_search()
+static int read_more(int max)
+{
+    int added = read_entries(current, max);
+    if (current->search[0] != '\0')
+    {
+        int index = search_entries(current->search);
+        if (index >= 0)
+            current->selected = index;
+        if (current->dir == NULL)
+            current->search[0] = '\0';
+    }
+    return added;
+}
+
+int dir_listing_fill(int count)
+{
+    if (current == NULL)
+        return 0;
+    if (current->count < count)
+        read_more(count - current->count);
+    return current->count;
+}
+
+// Read the vector table and the size of a firmware image
+static void check_image(int index)
+{
+    entry_t *entry = &current->entries[index];
+    char full_path[768];
+    snprintf(full_path, sizeof(full_path), "%s/%s", current->path, dir_listing_name(index));
+
+    entry->image = DIR_IMAGE_INVALID;
+    FILE *fp = fopen(full_path, "rb");
+    if (fp == NULL)
+    {
+        entry->size = 0;
+        return;
+    }
+    uint32_t vectors[2];
+    size_t len;
+    uint32_t image_size = 0;
+    if (lz4_image_is_name(full_path))
+        len = lz4_image_peek(fp, &image_size, (uint8_t *)vectors, sizeof(vectors)) ? sizeof(vectors) : 0;
+    else if (uf2_image_is_name(full_path))
+        len = uf2_image_peek(fp, &image_size, (uint8_t *)vectors, sizeof(vectors)) ? sizeof(vectors) : 0;
+    else
+        len = fread(vectors, 1, sizeof(vectors), fp);
+    fclose(fp);
+
+    struct stat statbuf;
+    bool found = stat(full_path, &statbuf) == 0;
+    entry->size = found ? statbuf.st_size : 0;
+    entry->mtime = found ? (uint32_t)statbuf.st_mtime : 0;
+    entry->stale = 0;
+    current->dirty = true;
+    if (image_size == 0)
+        image_size = entry->size;
+    if (len != sizeof(vectors))
+        return;
+    if (is_valid_application(vectors) && image_size <= SD_BOOT_APP_SLOT_SIZE)
+        entry->image = DIR_IMAGE_VALID;
+#if SD_BOOT_RAM_LAUNCH
+    // Plain images built to run from SRAM
+    if (!lz4_image_is_name(full_path) && !uf2_image_is_name(full_path) &&
+        is_ram_application(vectors, image_size))
+        entry->image = DIR_IMAGE_VALID;
+#endif
+}
+
+// Compare a file taken from the catalog with the card. Returns true if the
+// entry changed.
+static bool revalidate_entry(int index)
+{
+    entry_t *entry = &current->entries[index];
+    char full_path[768];
+    snprintf(full_path, sizeof(full_path), "%s/%s", current->path, dir_listing_name(index));
+    entry->stale = 0;
+
+    struct stat statbuf;
+    uint32_t size = 0, mtime = 0;
+    if (stat(full_path, &statbuf) == 0)
+    {
+        size = statbuf.st_size;
+        mtime = statbuf.st_mtime;
+    }
+    if (entry->image == DIR_IMAGE_NONE)
+    {
+        if (entry->size == size)
+            return false;
+        entry->size = size;
+        current->dirty = true;
+        return true;
+    }
+    if (entry->size == size && entry->mtime == mtime)
+        return false;
+    check_image(index);
+    return true;
+}
+
+#if SD_BOOT_CATALOG
+static void catalog_save(void);
+#endif
+bool dir_listing_read_ahead(int batch)
+{
+    if (current == NULL)
+        return false;
+    if (current->dir != NULL)
+        return read_more(batch) > 0;
+
+    // Read to the end: check one more image, entries no longer move
+    while (current->next_check < current->count)
+    {
+        int index = current->next_check++;
+        if (current->entries[index].image == DIR_IMAGE_UNKNOWN)
+        {
+            check_image(index);
+            return true;
+        }
+        if (current->entries[index].stale)
+            return revalidate_entry(index);
+    }
+#if SD_BOOT_CATALOG
+    if (current->dirty)
+        catalog_save();
+#endif
+    // Nothing left to do: dir_listing_complete() now holds
+    current->next_check = current->count + 1;
+    return false;
+}
+
+bool dir_listing_complete(void)
+{
+    return current == NULL || (current->dir == NULL && current->next_check > current->count);
+}
+
+int dir_listing_count(void)
+{
+    return current ? current->count : 0;
+}
+
+const char *dir_listing_name(int index)
+{
+    return current->names + current->entries[index].name;
+}
+
+bool dir_listing_is_dir(int index)
+{
+    return current->entries[index].is_dir;
+}
+
+off_t dir_listing_file_size(int index)
+{
+    entry_t *entry = &current->entries[index];
+    if (entry->image == DIR_IMAGE_UNKNOWN)
+        check_image(index);
+    if (entry->size == SIZE_UNKNOWN)
+    {
+        char full_path[768];
+        snprintf(full_path, sizeof(full_path), "%s/%s", current->path, dir_listing_name(index));
+        struct stat statbuf;
+        entry->size = (stat(full_path, &statbuf) == 0) ? statbuf.st_size : 0;
+    }
+    return entry->size;
+}
+
+dir_image_state_t dir_listing_image_state(int index)
+{
+    if (current->entries[index].image == DIR_IMAGE_UNKNOWN)
+        check_image(index);
+    return current->entries[index].image;
+}
+
+bool dir_listing_is_resident(int index)
+{
+    const entry_t *entry = &current->entries[index];
+    if (entry->image != DIR_IMAGE_VALID || entry->mtime == 0)
+        return false;
+    char full_path[768];
+    snprintf(full_path, sizeof(full_path), "%s/%s", current->path, dir_listing_name(index));
+    return boot_state_find_image(full_path, entry->size, entry->mtime) >= 0;
+}
+
+void dir_listing_set_firmware_only(bool enable)
+{
+    if (enable == firmware_only)
+        return;
+    firmware_only = enable;
+    dir_listing_invalidate();
+}
+
+bool dir_listing_get_firmware_only(void)
+{
+    return firmware_only;
+}
+
+int dir_listing_find(const char *name)
+{
+    // Entries not read yet are read until the name turns up
+    for (int i = 0; i < dir_listing_fill(i + 1); i++)
+    {
+        if (strcmp(dir_listing_name(i), name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// First entry in [lo, hi) whose name is not below prefix (compared on the prefix length)
+static int lower_bound(int lo, int hi, const char *prefix)
+{
+    size_t len = strlen(prefix);
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (strncasecmp(dir_listing_name(mid), prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Search the entries read so far
+static int search_entries(const char *prefix)
+{
+    int count = current->count;
+    if (count == 0)
+        return -1;
+
+    // Directories come first: find where the files start
+    int lo = 0, hi = count;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (current->entries[mid].is_dir)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int files = lo;
+    size_t len = strlen(prefix);
+
+    int index = lower_bound(0, files, prefix);
+    if (index < files && strncasecmp(dir_listing_name(index), prefix, len) == 0)
+        return index;
+    index = lower_bound(files, count, prefix);
+    if (index < count)
+        return index;
+    return count - 1;
+}
+
+int dir_listing_search(const char *prefix)
+{
+    if (current == NULL)
+        return -1;
+
+    // Directory order is unsorted, so an entry not read yet may still match
+    // better: the prefix is kept and the selection moved to the match again
+    // after each read_ahead batch, until the directory is read to the end
+    int index = search_entries(prefix);
+    if (index >= 0)
+        current->selected = index;
+    if (current->dir != NULL)
+    {
+        strncpy(current->search, prefix, sizeof(current->search) - 1);
+        current->search[sizeof(current->search) - 1] = '\0';
+    }
+    return index;
+}
+
+int dir_listing_get_selection(void)
+{
+    return current ? current->selected : 0;
+}
+
+void dir_listing_set_selection(int index)
+{
+    if (current == NULL)
+        return;
+    // Moved away from the match: stop following the typed prefix
+    if (index != current->selected)
+        current->search[0] = '\0';
+    current->selected = index;
+}
+
+void dir_listing_invalidate(void)
+{
+    for (int i = 0; i < SD_BOOT_DIR_CACHE_SLOTS; i++)
+        free_listing(&cache[i]);
+    current = NULL;
+#if SD_BOOT_CATALOG
+    // May be another card
+    catalog_dir_checked = false;
+#endif
+}
@@ -0,0 +1,80 @@
+/*
+ * dir_listing.h
+ *
+ */
+
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Result of checking a file as a firmware image
+typedef enum
+{
+    DIR_IMAGE_UNKNOWN, // Not checked yet
+    DIR_IMAGE_VALID,   // Plausible vector table, fits the application area
+    DIR_IMAGE_INVALID, // Would be rejected by the loader
+    DIR_IMAGE_NONE,    // Not a firmware file (directory or other extension)
+} dir_image_state_t;
+
+// Make the listing of path current. A directory that is not cached is opened,
+// but no entries are read yet. Returns false if it cannot be opened (the
+// listing is then empty).
+bool dir_listing_open(const char *path);
+
+// Read entries of the current listing until at least count are available or
+// the directory has been read to the end. Returns the number of entries.
+int dir_listing_fill(int count);
+
+// Idle work: read up to batch further entries or, once the directory has been
+// read to the end, check one more firmware image. Returns true if the listing changed.
+bool dir_listing_read_ahead(int batch);
+
+// Whether the current listing has been read to the end and all images checked
+bool dir_listing_complete(void);
+
+// Number of entries read so far in the current listing
+int dir_listing_count(void);
+
+// Name of an entry of the current listing; valid until the listing is dropped
+const char *dir_listing_name(int index);
+
+// Whether an entry of the current listing is a directory
+bool dir_listing_is_dir(int index);
+
+// Size of a file in the current listing; stat() is called the first time only
+off_t dir_listing_file_size(int index);
+
+// Check a file of the current listing as a firmware image (reads its first 8 bytes once)
+dir_image_state_t dir_listing_image_state(int index);
+
+// Whether a valid image of the current listing is resident in an application
+// slot, going by the file size and time the boot state recorded for it
+bool dir_listing_is_resident(int index);
+
+// Only list directories and firmware images; changing it drops all cached listings
+void dir_listing_set_firmware_only(bool enable);
+bool dir_listing_get_firmware_only(void);
+
+// Index of the entry with the given name, -1 if there is none. Reads further
+// entries as needed.
+int dir_listing_find(const char *name);
+
+// Index of the first entry (directories first, then files) starting with
+// prefix, ignoring case; the nearest following file if none does, -1 if the
+// listing is empty. Searches the entries read so far without waiting for the
+// card; until the directory is read to the end, dir_listing_read_ahead()
+// moves the selection to a better match as further entries arrive.
+int dir_listing_search(const char *prefix);
+
+// Selected entry remembered with the current listing (0 for a new listing).
+// It is moved when entries read later are sorted in before it.
+int dir_listing_get_selection(void);
+void dir_listing_set_selection(int index);
+
+// Drop all cached listings and free their memory, e.g. after the card was
+// removed or before an image is loaded
+void dir_listing_invalidate(void);
+
+#endif // DIR_LISTING_H
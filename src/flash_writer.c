@@ -0,0 +1,319 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * flash_writer.c
+ *
+ * Staged flash programming for application images.
+ *
+ * Incoming image data is collected in a multi-sector staging buffer, so the
+ * SD card is read in large requests (FatFs turns a multi-sector fread into a
+ * single multi-block read straight into the buffer) instead of one 4KB read
+ * per erase/program cycle. When the buffer is full its sectors are flushed:
+ *  - Differential mode: sectors that already match the flash are skipped.
+ *  - Mostly dirty 64KB blocks are erased with one block erase, other dirty
+ *    sectors are coalesced into runs.
+ *  - Short final sectors are padded with 0xFF so only whole pages are programmed.
+ *  - Sparse images (UF2) seek over the gaps between their ranges; sectors
+ *    without any data are neither erased nor programmed.
+ *  - A blank sector is left after the image so its end can be detected.
+ *  - The slot's image recorded in the boot state is invalidated before the first
+ *    erase, so an interrupted load is never mistaken for a complete image.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include <hardware/flash.h>
+#include "config.h"
+#include "debug.h"
+#include "flash_writer.h"
+#include "boot_state.h"
+#include "app_slot.h"
+#include "boot_trace.h"
+
+static struct
+{
+    uint8_t *buffer;      // Staging buffer, a whole number of sectors
+    size_t buffer_size;   // Size of the staging buffer in bytes
+    size_t fill;          // Bytes currently staged
+    uint32_t start;       // Flash offset of the image
+    uint32_t base;        // Flash offset of the first staged byte
+    uint32_t limit;       // End of the writable flash area
+    bool modified;        // The image in flash has been changed
+    flash_writer_stats_t stats;
+} writer;
+
+bool __not_in_flash_func(flash_writer_is_erased)(uint32_t flash_offset, size_t len)
+{
+    const uint32_t *flash = (const uint32_t *)(XIP_BASE + flash_offset);
+    for (size_t i = 0; i < len / sizeof(uint32_t); i++)
+    {
+        if (flash[i] != 0xFFFFFFFF)
+            return false;
+    }
+    return true;
+}
+
+// Erase a range and program the staged data at its start
+static void __not_in_flash_func(erase_and_program)(uint32_t flash_offset, size_t erase_len,
+                                                   const uint8_t *data, size_t program_len)
+{
+    // The recorded image is no longer complete from here on
+    if (!writer.modified)
+    {
+        boot_state_invalidate_image(app_slot_of_offset(writer.start));
+        writer.modified = true;
+    }
+
+    BOOT_TRACE_ADD(TRACE_SECTORS_ERASED, erase_len / FLASH_SECTOR_SIZE);
+    BOOT_TRACE_ADD(TRACE_SECTORS_PROGRAMMED, program_len / FLASH_SECTOR_SIZE);
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(flash_offset, erase_len);
+    flash_range_program(flash_offset, data, program_len);
+    restore_interrupts(ints);
+}
+
+// Write the staged sectors to flash and empty the staging buffer; final is
+// set for the last flush of the image.
+//
+// Erase planner: a 64KB aligned block with at least
+// SD_BOOT_BLOCK_ERASE_MIN_DIRTY changed sectors is erased with a single
+// block erase and fully reprogrammed from the staging buffer (the clean
+// sectors are identical anyway). Elsewhere each run of consecutive dirty
+// sectors is erased and programmed as one range.
+static void __not_in_flash_func(flush)(bool final)
+{
+    size_t sectors = (writer.fill + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+    bool dirty[SD_BOOT_LOAD_BUFFER_SIZE / FLASH_SECTOR_SIZE];
+
+    // Pad the final sector so it can be compared and programmed as a whole
+    memset(writer.buffer + writer.fill, 0xFF, sectors * FLASH_SECTOR_SIZE - writer.fill);
+
+    for (size_t i = 0; i < sectors; i++)
+    {
+#if SD_BOOT_DIFF_FLASH
+        uint32_t offset = writer.base + i * FLASH_SECTOR_SIZE;
+        dirty[i] = memcmp(writer.buffer + i * FLASH_SECTOR_SIZE,
+                          (const uint8_t *)(XIP_BASE + offset), FLASH_SECTOR_SIZE) != 0;
+#else
+        dirty[i] = true;
+#endif
+    }
+
+    size_t i = 0;
+    while (i < sectors)
+    {
+        uint32_t offset = writer.base + i * FLASH_SECTOR_SIZE;
+
+        // Whole block: it must be staged completely, since the rest would be
+        // erased and then written by a later flush (a staging buffer may be
+        // smaller than a block, and a sparse image may skip those sectors).
+        // Only on the final flush may the rest lie past the end of the image.
+        if ((offset % FLASH_BLOCK_SIZE) == 0 && offset + FLASH_BLOCK_SIZE <= writer.limit &&
+            (final || sectors - i >= FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE))
+        {
+            size_t n = sectors - i;
+            if (n > FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE)
+                n = FLASH_BLOCK_SIZE / FLASH_SECTOR_SIZE;
+            size_t dirty_count = 0;
+            for (size_t j = i; j < i + n; j++)
+                dirty_count += dirty[j];
+
+            if (dirty_count >= SD_BOOT_BLOCK_ERASE_MIN_DIRTY)
+            {
+                erase_and_program(offset, FLASH_BLOCK_SIZE,
+                                  writer.buffer + i * FLASH_SECTOR_SIZE, n * FLASH_SECTOR_SIZE);
+                writer.stats.sectors_written += n;
+                writer.stats.blocks_erased++;
+                i += n;
+                continue;
+            }
+        }
+
+        if (!dirty[i])
+        {
+            i++;
+            continue;
+        }
+
+        // Run of dirty sectors, stopping at the next block boundary so the
+        // block check above gets a chance there
+        size_t run = 1;
+        while (i + run < sectors && dirty[i + run] &&
+               ((offset + run * FLASH_SECTOR_SIZE) % FLASH_BLOCK_SIZE) != 0)
+            run++;
+
+        erase_and_program(offset, run * FLASH_SECTOR_SIZE,
+                          writer.buffer + i * FLASH_SECTOR_SIZE, run * FLASH_SECTOR_SIZE);
+        writer.stats.sectors_written += run;
+        i += run;
+    }
+
+    writer.stats.sectors_total += sectors;
+    writer.base += sectors * FLASH_SECTOR_SIZE;
+    writer.fill = 0;
+}
+
+bool flash_writer_begin(uint32_t flash_offset, size_t max_size)
+{
+    flash_writer_abort();
+
+    // Fall back to a smaller staging buffer if the heap is tight
+    size_t size = SD_BOOT_LOAD_BUFFER_SIZE;
+    while ((writer.buffer = malloc(size)) == NULL && size > FLASH_SECTOR_SIZE)
+        size /= 2;
+    if (writer.buffer == NULL)
+    {
+        DEBUG_PRINT("flash writer: out of memory\n");
+        return false;
+    }
+
+    DEBUG_PRINT("flash writer: %u byte buffer\n", (unsigned)size);
+    writer.buffer_size = size;
+    writer.fill = 0;
+    writer.start = flash_offset;
+    writer.base = flash_offset;
+    writer.limit = flash_offset + max_size;
+    writer.modified = false;
+    memset(&writer.stats, 0, sizeof(writer.stats));
+    return true;
+}
+
+uint8_t *flash_writer_reserve(size_t *space)
+{
+    *space = writer.buffer_size - writer.fill;
+    return writer.buffer + writer.fill;
+}
+
+bool __not_in_flash_func(flash_writer_commit)(size_t len)
+{
+    if (writer.base + writer.fill + len > writer.limit)
+    {
+        DEBUG_PRINT("err: write beyond app area\n");
+        return false;
+    }
+
+    writer.fill += len;
+    if (writer.fill == writer.buffer_size)
+        flush(false);
+    return true;
+}
+
+bool flash_writer_write(const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        size_t space;
+        uint8_t *dst = flash_writer_reserve(&space);
+        size_t n = len < space ? len : space;
+        memcpy(dst, data, n);
+        if (!flash_writer_commit(n))
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool __not_in_flash_func(flash_writer_seek)(uint32_t image_offset)
+{
+    uint32_t flash_offset = writer.start + image_offset;
+    uint32_t pos = writer.base + writer.fill;
+    if (flash_offset < pos || flash_offset > writer.limit)
+    {
+        DEBUG_PRINT("err: seek to %08x from %08x\n", (unsigned)flash_offset, (unsigned)pos);
+        return false;
+    }
+
+    // No whole sector is skipped: the gap becomes 0xFF, like the rest of a
+    // partly written sector
+    uint32_t next_sector = (pos + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    if (flash_offset < next_sector + FLASH_SECTOR_SIZE)
+    {
+        size_t gap = flash_offset - pos;
+        while (gap > 0)
+        {
+            size_t space;
+            uint8_t *dst = flash_writer_reserve(&space);
+            size_t n = gap < space ? gap : space;
+            memset(dst, 0xFF, n);
+            flash_writer_commit(n);
+            gap -= n;
+        }
+        return true;
+    }
+
+    // Whole sectors are skipped: write out what is staged and continue at
+    // the sector of the new position, leaving the skipped ones untouched
+    if (writer.fill > 0)
+        flush(false);
+    writer.base = flash_offset & ~(FLASH_SECTOR_SIZE - 1);
+    writer.fill = flash_offset - writer.base;
+    memset(writer.buffer, 0xFF, writer.fill);
+    return true;
+}
+
+bool flash_writer_repeat(size_t distance, size_t len)
+{
+    if (distance == 0 || distance > writer.base - writer.start + writer.fill)
+        return false;
+
+    while (len > 0)
+    {
+        size_t space;
+        uint8_t *dst = flash_writer_reserve(&space);
+        size_t n = len < space ? len : space;
+        // Byte by byte, the source may overlap the data being appended.
+        // Anything before the staging buffer has already been flushed, so it
+        // is read back through XIP.
+        for (size_t i = 0; i < n; i++)
+        {
+            int32_t src = (int32_t)(writer.fill + i) - (int32_t)distance;
+            dst[i] = src >= 0 ? writer.buffer[src]
+                              : *(const uint8_t *)(XIP_BASE + writer.base + src);
+        }
+        if (!flash_writer_commit(n))
+            return false;
+        len -= n;
+    }
+    return true;
+}
+
+bool __not_in_flash_func(flash_writer_finish)(flash_writer_stats_t *stats)
+{
+    if (writer.buffer == NULL)
+        return false;
+
+    if (writer.fill > 0)
+        flush(true);
+
+    // Leave a blank sector after the image so a later up-to-date check
+    // can tell where it ends
+    if (writer.base < writer.limit && !flash_writer_is_erased(writer.base, FLASH_SECTOR_SIZE))
+    {
+        BOOT_TRACE_ADD(TRACE_SECTORS_ERASED, 1);
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_erase(writer.base, FLASH_SECTOR_SIZE);
+        restore_interrupts(ints);
+    }
+
+    if (stats)
+        *stats = writer.stats;
+    flash_writer_abort();
+    return true;
+}
+
+void flash_writer_abort(void)
+{
+    free(writer.buffer);
+    writer.buffer = NULL;
+    writer.buffer_size = 0;
+    writer.fill = 0;
+}
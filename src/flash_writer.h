@@ -0,0 +1,57 @@
+/*
+ * flash_writer.h
+ *
+ */
+
+#ifndef FLASH_WRITER_H
+#define FLASH_WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Counters reported by flash_writer_finish()
+typedef struct
+{
+    int sectors_total;   // Sectors covered by the image
+    int sectors_written; // Sectors that were actually erased and programmed
+    int blocks_erased;   // 64KB block erases issued by the erase planner
+} flash_writer_stats_t;
+
+// Start writing an image of at most max_size bytes at flash_offset (sector aligned).
+// Allocates the staging buffer; returns false if no memory is available.
+bool flash_writer_begin(uint32_t flash_offset, size_t max_size);
+
+// Get a pointer to the free space in the staging buffer so the caller can read
+// straight into it. The available size is returned in *space (never 0).
+uint8_t *flash_writer_reserve(size_t *space);
+
+// Account for len bytes placed into the space returned by flash_writer_reserve().
+// A full staging buffer is flushed to flash. Returns false on overflow.
+bool flash_writer_commit(size_t len);
+
+// Copy len bytes into the staging buffer, flushing as required.
+bool flash_writer_write(const uint8_t *data, size_t len);
+
+// Continue writing at image_offset from the start of the image, at or after
+// the current position (sparse images). Sectors skipped over entirely are left untouched, a gap within a
+// sector reads back as 0xFF. Returns false for a position before the current
+// one or outside the writable area.
+bool flash_writer_seek(uint32_t image_offset);
+
+// Append len bytes copied from distance bytes back in the image written so far
+// (an LZ77 style back-reference, may overlap). Returns false if distance
+// reaches before the start of the image or on overflow.
+bool flash_writer_repeat(size_t distance, size_t len);
+
+// Flush the remaining data, blank the sector after the image and free the
+// staging buffer. The optional stats are filled in.
+bool flash_writer_finish(flash_writer_stats_t *stats);
+
+// Drop the staging buffer without flushing (error paths).
+void flash_writer_abort(void);
+
+// Check whether a flash range is still in the erased (all 0xFF) state.
+bool flash_writer_is_erased(uint32_t flash_offset, size_t len);
+
+#endif // FLASH_WRITER_H
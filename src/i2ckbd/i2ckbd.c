@@ -5,38 +5,33 @@
 
 static uint8_t i2c_inited = 0;
 
-void init_i2c_kbd() {
-    gpio_set_function(I2C_KBD_SCL, GPIO_FUNC_I2C);
-    gpio_set_function(I2C_KBD_SDA, GPIO_FUNC_I2C);
-    i2c_init(I2C_KBD_MOD, I2C_KBD_SPEED);
-    gpio_pull_up(I2C_KBD_SCL);
-    gpio_pull_up(I2C_KBD_SDA);
+/*
+ * Keyboard polling runs as a non-blocking state machine on a repeating timer:
+ * each tick only looks at the I2C controller's status and FIFO registers and
+ * moves on when the bus is done, so neither the tick nor the UI ever waits
+ * for the (slow) keyboard bus. Key presses are queued in a ring buffer that
+ * read_i2c_kbd() takes them from.
+ */
+typedef enum {
+    KBD_IDLE,     // waiting for the next poll
+    KBD_WRITE,    // register address sent, waiting for the stop condition
+    KBD_DELAY,    // giving the keyboard controller time to prepare the answer
+    KBD_READ,     // read requested, waiting for two bytes
+} kbd_state_t;
 
-    i2c_inited = 1;
-}
+static volatile kbd_state_t kbd_state = KBD_IDLE;
+static volatile bool kbd_bus_locked = false; // a blocking transfer owns the bus
+static uint64_t kbd_deadline = 0;
+static volatile uint32_t kbd_timeouts = 0; // counted in the tick, reported by read_i2c_kbd()
+static volatile uint32_t kbd_reads = 0;    // keyboard FIFO reads completed
+static repeating_timer_t kbd_timer;
 
-int read_i2c_kbd() {
-    int retval;
+static volatile uint8_t key_ring[I2C_KBD_QUEUE_SIZE];
+static volatile uint8_t key_head = 0, key_tail = 0;
+
+static int decode_event(uint16_t buff) {
     static int ctrlheld = 0;
-    uint16_t buff = 0;
-    unsigned char msg[2];
     int c = -1;
-    msg[0] = 0x09;
-
-    if (i2c_inited == 0) return -1;
-
-    retval = i2c_write_timeout_us(I2C_KBD_MOD, I2C_KBD_ADDR, msg, 1, false, 500000);
-    if (retval == PICO_ERROR_GENERIC || retval == PICO_ERROR_TIMEOUT) {
-        DEBUG_PRINT("I2C write err\n");
-        return -1;
-    }
-
-    sleep_ms(16);
-    retval = i2c_read_timeout_us(I2C_KBD_MOD, I2C_KBD_ADDR, (unsigned char *) &buff, 2, false, 500000);
-    if (retval == PICO_ERROR_GENERIC || retval == PICO_ERROR_TIMEOUT) {
-        DEBUG_PRINT("I2C read err\n");
-        return -1;
-    }
 
     if (buff != 0) {
         if (buff == 0x7e03)ctrlheld = 0;
@@ -53,9 +48,133 @@ int read_i2c_kbd() {
             c = realc;
             if (c >= 'a' && c <= 'z' && ctrlheld)c = c - 'a' + 1;
         }
-        return c;
     }
-    return -1;
+    return c;
+}
+
+static void queue_key(int c) {
+    uint8_t next = (key_head + 1) % I2C_KBD_QUEUE_SIZE;
+    if (next == key_tail) return; // full: drop the key
+    key_ring[key_head] = c;
+    key_head = next;
+}
+
+static bool __not_in_flash_func(kbd_tick)(repeating_timer_t *rt) {
+    i2c_hw_t *hw = i2c_get_hw(I2C_KBD_MOD);
+    uint64_t now = time_us_64();
+
+    if (kbd_state != KBD_IDLE && (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS)) {
+        // no acknowledge: try again with the next poll
+        (void) hw->clr_tx_abrt;
+        (void) hw->clr_stop_det;
+        while (hw->rxflr) (void) hw->data_cmd;
+        kbd_state = KBD_IDLE;
+        kbd_deadline = now + I2C_KBD_POLL_US;
+        return true;
+    }
+
+    switch (kbd_state) {
+        case KBD_IDLE:
+            if (kbd_bus_locked || now < kbd_deadline) break;
+            (void) hw->clr_stop_det;
+            hw->data_cmd = 0x09 | I2C_IC_DATA_CMD_STOP_BITS; // FIFO read register
+            kbd_deadline = now + I2C_KBD_TIMEOUT_US;
+            kbd_state = KBD_WRITE;
+            break;
+        case KBD_WRITE:
+            if (hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) {
+                (void) hw->clr_stop_det;
+                kbd_deadline = now + I2C_KBD_READ_DELAY_US;
+                kbd_state = KBD_DELAY;
+            } else if (now > kbd_deadline) {
+                kbd_timeouts++;
+                kbd_deadline = now + I2C_KBD_POLL_US;
+                kbd_state = KBD_IDLE;
+            }
+            break;
+        case KBD_DELAY:
+            if (now < kbd_deadline) break;
+            hw->data_cmd = I2C_IC_DATA_CMD_CMD_BITS;
+            hw->data_cmd = I2C_IC_DATA_CMD_CMD_BITS | I2C_IC_DATA_CMD_STOP_BITS;
+            kbd_deadline = now + I2C_KBD_TIMEOUT_US;
+            kbd_state = KBD_READ;
+            break;
+        case KBD_READ:
+            if (hw->rxflr >= 2) {
+                uint16_t buff = hw->data_cmd & 0xFF;
+                buff |= (hw->data_cmd & 0xFF) << 8;
+                (void) hw->clr_stop_det;
+                int c = decode_event(buff);
+                if (c >= 0) queue_key(c);
+                kbd_reads++;
+                kbd_deadline = now + I2C_KBD_POLL_US;
+                kbd_state = KBD_IDLE;
+            } else if (now > kbd_deadline) {
+                // no printing here: stdio may be locked by the interrupted code
+                kbd_timeouts++;
+                while (hw->rxflr) (void) hw->data_cmd;
+                kbd_deadline = now + I2C_KBD_POLL_US;
+                kbd_state = KBD_IDLE;
+            }
+            break;
+    }
+    return true;
+}
+
+void init_i2c_kbd() {
+    gpio_set_function(I2C_KBD_SCL, GPIO_FUNC_I2C);
+    gpio_set_function(I2C_KBD_SDA, GPIO_FUNC_I2C);
+    i2c_init(I2C_KBD_MOD, I2C_KBD_SPEED);
+    gpio_pull_up(I2C_KBD_SCL);
+    gpio_pull_up(I2C_KBD_SDA);
+
+    // the keyboard is the only target this driver talks to
+    i2c_hw_t *hw = i2c_get_hw(I2C_KBD_MOD);
+    hw->enable = 0;
+    hw->tar = I2C_KBD_ADDR;
+    hw->enable = 1;
+
+    kbd_state = KBD_IDLE;
+    kbd_deadline = 0;
+    key_head = key_tail = 0;
+    add_repeating_timer_us(-I2C_KBD_TICK_US, kbd_tick, NULL, &kbd_timer);
+
+    i2c_inited = 1;
+}
+
+void deinit_i2c_kbd() {
+    if (i2c_inited == 0) return;
+    cancel_repeating_timer(&kbd_timer);
+    i2c_inited = 0;
+}
+
+// Next key press from the queue, -1 if there is none; never waits for the bus
+int read_i2c_kbd() {
+    if (i2c_inited == 0) return -1;
+    if (kbd_timeouts != 0) {
+        DEBUG_PRINT("I2C kbd timeout x%u\n", (unsigned) kbd_timeouts);
+        kbd_timeouts = 0;
+    }
+    if (key_tail == key_head) return -1;
+    int c = key_ring[key_tail];
+    key_tail = (key_tail + 1) % I2C_KBD_QUEUE_SIZE;
+    return c;
+}
+
+// Reads of the keyboard FIFO completed so far; a key reported by one is
+// queued before the count moves on
+uint32_t i2c_kbd_reads() {
+    return kbd_reads;
+}
+
+// Take the bus from the polling state machine for a blocking transfer
+static void lock_bus(void) {
+    kbd_bus_locked = true;
+    while (kbd_state != KBD_IDLE) tight_loop_contents();
+}
+
+static void unlock_bus(void) {
+    kbd_bus_locked = false;
 }
 
 int read_battery() {
@@ -66,13 +185,16 @@ int read_battery() {
 
     if (i2c_inited == 0) return -1;
 
+    lock_bus();
     retval = i2c_write_timeout_us(I2C_KBD_MOD, I2C_KBD_ADDR, msg, 1, false, 500000);
     if (retval == PICO_ERROR_GENERIC || retval == PICO_ERROR_TIMEOUT) {
         DEBUG_PRINT("Batt I2C write err\n");
+        unlock_bus();
         return -1;
     }
     sleep_ms(16);
     retval = i2c_read_timeout_us(I2C_KBD_MOD, I2C_KBD_ADDR, (unsigned char *) &buff, 2, false, 500000);
+    unlock_bus();
     if (retval == PICO_ERROR_GENERIC || retval == PICO_ERROR_TIMEOUT) {
         DEBUG_PRINT("Batt I2C read err\n");
         return -1;
@@ -9,12 +9,29 @@
 #define I2C_KBD_SDA 6
 #define I2C_KBD_SCL 7
 
-#define I2C_KBD_SPEED  10000 // if dual i2c, then the speed of keyboard i2c should be 10khz
+// if dual i2c, then the speed of keyboard i2c should be 10khz; with the keyboard
+// as the only device on the bus it can be raised, e.g. to 100000
+#ifndef I2C_KBD_SPEED
+#define I2C_KBD_SPEED  10000
+#endif
+
+// Keyboard polling state machine (all times in microseconds)
+#define I2C_KBD_TICK_US        1000  // state machine step interval
+#define I2C_KBD_POLL_US        5000  // pause between two polls of the keyboard
+#ifndef I2C_KBD_READ_DELAY_US
+#define I2C_KBD_READ_DELAY_US  16000 // keyboard controller answer time after the register write
+#endif
+#define I2C_KBD_TIMEOUT_US     50000 // give up on a transfer that does not complete
+#define I2C_KBD_QUEUE_SIZE     16    // queued key presses
 
 #define I2C_KBD_ADDR 0x1F
 
 void init_i2c_kbd();
+// Stop polling, e.g. before another program takes over the hardware
+void deinit_i2c_kbd();
 int read_i2c_kbd();
+// Number of completed keyboard polls, to tell when no key is being reported
+uint32_t i2c_kbd_reads();
 int read_battery();
 
 #endif
\ No newline at end of file
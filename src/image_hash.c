@@ -0,0 +1,118 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * image_hash.c
+ *
+ * Hardware assisted digests of application images.
+ *
+ * RP2350 feeds the data through the SHA-256 accelerator, RP2040 runs a
+ * word wide DMA transfer into a dummy sink with the DMA sniffer set to
+ * CRC-32. Either way the CPU only waits for the DMA, so verifying a
+ * multi-MB image is bound by the XIP read speed.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "image_hash.h"
+#include "debug.h"
+
+#if PICO_RP2350
+#include "pico/sha256.h"
+
+static pico_sha256_state_t sha_state;
+
+bool image_hash_begin(void)
+{
+    return pico_sha256_start_blocking(&sha_state, SHA256_BIG_ENDIAN, true) == PICO_OK;
+}
+
+static void hash_words(const void *data, size_t len)
+{
+    pico_sha256_update_blocking(&sha_state, (const uint8_t *)data, len);
+}
+
+static void hash_result(image_hash_t *hash)
+{
+    sha256_result_t result;
+    pico_sha256_finish(&sha_state, &result);
+    memcpy(hash->bytes, result.bytes, sizeof(hash->bytes));
+}
+
+#else
+
+static int sniff_channel = -1;
+static uint32_t sniff_sink;
+
+bool image_hash_begin(void)
+{
+    if (sniff_channel < 0)
+        sniff_channel = dma_claim_unused_channel(false);
+    if (sniff_channel < 0)
+        return false;
+
+    // Feed the bytes of each word in memory order
+    dma_sniffer_enable(sniff_channel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32, true);
+    dma_sniffer_set_byte_swap_enabled(true);
+    dma_sniffer_set_data_accumulator(0xFFFFFFFF);
+    return true;
+}
+
+static void hash_words(const void *data, size_t len)
+{
+    dma_channel_config c = dma_channel_get_default_config(sniff_channel);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_sniff_enable(&c, true);
+    dma_channel_configure(sniff_channel, &c, &sniff_sink, data, len / sizeof(uint32_t), true);
+    dma_channel_wait_for_finish_blocking(sniff_channel);
+}
+
+static void hash_result(image_hash_t *hash)
+{
+    uint32_t crc = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    memcpy(hash->bytes, &crc, sizeof(hash->bytes));
+}
+
+#endif
+
+void image_hash_update(const void *data, size_t len)
+{
+    size_t aligned = len & ~(sizeof(uint32_t) - 1);
+    if (aligned > 0)
+        hash_words(data, aligned);
+
+    // A short tail is padded to a whole word with 0xFF, like erased flash
+    if (aligned < len)
+    {
+        uint32_t tail = 0xFFFFFFFF;
+        memcpy(&tail, (const uint8_t *)data + aligned, len - aligned);
+        hash_words(&tail, sizeof(tail));
+    }
+}
+
+void image_hash_end(image_hash_t *hash)
+{
+    hash_result(hash);
+}
+
+bool image_hash_flash(uint32_t flash_offset, size_t len, image_hash_t *hash)
+{
+    if (!image_hash_begin())
+    {
+        DEBUG_PRINT("image hash: no DMA channel\n");
+        return false;
+    }
+
+    // Whole words straight from XIP, the erased flash supplies the padding
+    image_hash_update((const void *)(XIP_BASE + flash_offset), (len + 3) & ~(size_t)3);
+    image_hash_end(hash);
+    return true;
+}
@@ -0,0 +1,38 @@
+/*
+ * image_hash.h
+ *
+ */
+
+#ifndef IMAGE_HASH_H
+#define IMAGE_HASH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "pico.h"
+
+// Image digest: SHA-256 on RP2350 (SHA-256 block), CRC-32 on RP2040 (DMA sniffer).
+// The digest covers the image length rounded up to a whole word, with the
+// padding bytes set to 0xFF, so it is the same whether taken over the erased
+// tail of the flash or over a padded RAM buffer.
+#if PICO_RP2350
+#define IMAGE_HASH_SIZE 32
+#else
+#define IMAGE_HASH_SIZE 4
+#endif
+
+typedef struct
+{
+    uint8_t bytes[IMAGE_HASH_SIZE];
+} image_hash_t;
+
+// Streaming interface. Every update but the last one must be a multiple of
+// 4 bytes long and start on a word aligned address.
+bool image_hash_begin(void);
+void image_hash_update(const void *data, size_t len);
+void image_hash_end(image_hash_t *hash);
+
+// Digest of len bytes of flash at flash_offset (relative to the flash start).
+bool image_hash_flash(uint32_t flash_offset, size_t len, image_hash_t *hash);
+
+#endif // IMAGE_HASH_H
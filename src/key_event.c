@@ -24,6 +24,11 @@ void keypad_init(void)
     init_i2c_kbd();
 }
 
+void keypad_deinit(void)
+{
+    deinit_i2c_kbd();
+}
+
 int keypad_get_key(void)
 {   
     int r = read_i2c_kbd();
@@ -53,8 +58,11 @@ int keypad_get_key(void)
             break;
 
         // Special Keys
-        case 0x81: case 0x82: case 0x83: case 0x84: case 0x85:
-        case 0x86: case 0x87: case 0x88: case 0x89: case 0x90: // F1-F10 Keys
+        case 0x81: // F1
+            act_key = KEY_F1;
+            break;
+        case 0x82: case 0x83: case 0x84: case 0x85:
+        case 0x86: case 0x87: case 0x88: case 0x89: case 0x90: // F2-F10 Keys
             DEBUG_PRINT("Warn: F-key unmapped\n");
             act_key = 0;
             break;
@@ -63,7 +71,7 @@ int keypad_get_key(void)
             act_key = 0;
             break;
         case 0x09: // TAB
-            act_key = 0;
+            act_key = KEY_TAB;
             break;
         case 0xC1: // Caps Lock
             act_key = 0;
@@ -79,10 +87,10 @@ int keypad_get_key(void)
             act_key = 0;
             break;
         case 0xD2: // Home
-            act_key = 0;
+            act_key = KEY_HOME;
             break;
         case 0xD5: // End
-            act_key = 0;
+            act_key = KEY_END;
             break;
 
         case 0x60: case 0x2F: case 0x5C: case 0x2D: case 0x3D:
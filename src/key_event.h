@@ -13,9 +13,15 @@ typedef enum {
     KEY_ARROW_DOWN = 0xB6,
     KEY_BACKSPACE = 0x08,
     KEY_ENTER = 0x0A,
+    KEY_TAB = 0x09,
+    KEY_HOME = 0xD2,
+    KEY_END = 0xD5,
+    KEY_F1 = 0x81,
 } lv_key_t;
 
 void keypad_init(void);
+// Stop the background keyboard polling (before launching an application)
+void keypad_deinit(void);
 int keypad_get_key(void);
 
 #endif // KEY_EVENT_H
@@ -1,9 +1,11 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include <hardware/spi.h>
 #include "hardware/timer.h"
+#include "hardware/dma.h"
 #include <ctype.h>
 #include <stdio.h>
 
@@ -26,6 +28,124 @@ static char s_width;
 int lcd_char_pos = 0;
 unsigned char lcd_buffer[320 * 3] = {0};// 1440 = 480*3, 320*3 = 960
 
+// Hardware vertical scrolling: rows scroll_top .. scroll_top + scroll_height - 1 form a
+// ring in the frame memory that is rotated by scroll_offset lines. Callers keep drawing
+// in screen coordinates, define_region_spi() maps them into the frame memory.
+static uint32_t lcd_spi_speed = LCD_SPI_SPEED;
+static short scroll_top = 0, scroll_height = 0, scroll_offset = 0;
+
+static int map_row(int y) {
+    if (scroll_height == 0 || y < scroll_top || y >= scroll_top + scroll_height) return y;
+    return scroll_top + (y - scroll_top + scroll_offset) % scroll_height;
+}
+
+// Number of rows from y1 (at most up to y2) that are consecutive in the frame memory,
+// so they can be sent as one window
+static int contiguous_rows(int y1, int y2) {
+    int end = y2 + 1;
+    if (scroll_height != 0) {
+        int wrap = scroll_top + scroll_height - scroll_offset;
+        if (y1 < scroll_top) {
+            if (end > scroll_top) end = scroll_top;
+        } else if (y1 < wrap) {
+            if (end > wrap) end = wrap;
+        } else if (y1 < scroll_top + scroll_height) {
+            if (end > scroll_top + scroll_height) end = scroll_top + scroll_height;
+        }
+    }
+    return end - y1;
+}
+
+#if LCD_USE_DMA
+// DMA backend: a transfer leaves CS low and returns at once, the next access
+// to the panel waits for it in lcd_wait_idle()
+static int lcd_dma_chan = -1;
+static volatile bool lcd_dma_active = false;
+static bool lcd_dma_wide = false; // SPI switched to 12-bit frames for a fill
+static uint16_t lcd_fill_pattern[2] __attribute__((aligned(4)));
+// Glyph blits alternate between two buffers, so the next glyph is rendered
+// while the previous one is still being sent
+static unsigned char lcd_glyph_buffer[2][LCD_GLYPH_BUFFER_SIZE];
+static int lcd_glyph_index = 0;
+
+void lcd_wait_idle(void) {
+    if (!lcd_dma_active) return;
+    dma_channel_wait_for_finish_blocking(lcd_dma_chan);
+    spi_finish(Pico_LCD_SPI_MOD);
+    if (lcd_dma_wide) {
+        spi_set_format(Pico_LCD_SPI_MOD, 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+        lcd_dma_wide = false;
+    }
+    lcd_dma_active = false;
+    lcd_spi_raise_cs();
+}
+
+// Stream a solid colour into the current region. An RGB888 pixel is sent as
+// two 12-bit frames, so the pattern repeats every two halfwords and the DMA
+// can read it from a 4-byte ring instead of a prebuilt row.
+static void lcd_dma_fill(uint32_t pixels, int c) {
+    lcd_fill_pattern[0] = (c >> 12) & 0xFFF;
+    lcd_fill_pattern[1] = c & 0xFFF;
+    spi_set_format(Pico_LCD_SPI_MOD, 12, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    lcd_dma_wide = true;
+
+    dma_channel_config cfg = dma_channel_get_default_config(lcd_dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_ring(&cfg, false, 2);
+    channel_config_set_dreq(&cfg, spi_get_dreq(Pico_LCD_SPI_MOD, true));
+    lcd_dma_active = true;
+    dma_channel_configure(lcd_dma_chan, &cfg, &spi_get_hw(Pico_LCD_SPI_MOD)->dr,
+                          lcd_fill_pattern, pixels * 2, true);
+}
+
+// Stream a buffer into the current region; it must stay untouched until the
+// transfer has finished
+static void lcd_dma_send(const unsigned char *buff, uint32_t len) {
+    dma_channel_config cfg = dma_channel_get_default_config(lcd_dma_chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, spi_get_dreq(Pico_LCD_SPI_MOD, true));
+    lcd_dma_active = true;
+    dma_channel_configure(lcd_dma_chan, &cfg, &spi_get_hw(Pico_LCD_SPI_MOD)->dr,
+                          buff, len, true);
+}
+
+// Queue another buffer behind the running transfer, in the same window
+static void lcd_dma_send_more(const unsigned char *buff, uint32_t len) {
+    if (lcd_dma_active) dma_channel_wait_for_finish_blocking(lcd_dma_chan);
+    lcd_dma_send(buff, len);
+}
+
+// Render a 1bpp bitmap into RGB888 and start sending it. Only used for
+// bitmaps that are completely on screen and have an opaque background.
+static void lcd_dma_bitmap(int x1, int y1, int width, int height, int scale, int fc, int bc,
+                           unsigned char *bitmap) {
+    unsigned char *out = lcd_glyph_buffer[lcd_glyph_index];
+    lcd_glyph_index ^= 1;
+    int n = 0;
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < scale; j++) {
+            for (int k = 0; k < width; k++) {
+                int bit = (bitmap[((i * width) + k) / 8] >> (((height * width) - ((i * width) + k) - 1) % 8)) & 1;
+                int col = bit ? fc : bc;
+                for (int m = 0; m < scale; m++) {
+                    out[n++] = col >> 16;
+                    out[n++] = (col >> 8) & 0xFF;
+                    out[n++] = col & 0xFF;
+                }
+            }
+        }
+    }
+    draw_rgb888_spi(x1, y1, x1 + width * scale - 1, y1 + height * scale - 1, out);
+}
+#else
+void lcd_wait_idle(void) {
+}
+#endif
+
 void __not_in_flash_func(spi_write_fast)(spi_inst_t *spi, const uint8_t *src, size_t len) {
     // Write to TX FIFO whilst ignoring RX, then clean up afterward. When RX
     // is full, PL022 inhibits RX pushes, and sets a sticky flag on
@@ -52,6 +172,14 @@ void __not_in_flash_func(spi_finish)(spi_inst_t *spi) {
 }
 
 void draw_line_spi(int x1, int y1, int x2, int y2, int color) {
+    // horizontal and vertical lines are a single window fill
+    if (y1 == y2 || x1 == x2) {
+        if ((x1 < 0 && x2 < 0) || (x1 >= hres && x2 >= hres)) return;
+        if ((y1 < 0 && y2 < 0) || (y1 >= vres && y2 >= vres)) return;
+        draw_rect_spi(x1, y1, x2, y2, color);
+        return;
+    }
+
     int dx = abs(x2 - x1), sx = x1 < x2 ? 1 : -1;
     int dy = abs(y2 - y1), sy = y1 < y2 ? 1 : -1;
     int err = (dx > dy ? dx : -dy) / 2, e2;
@@ -75,6 +203,9 @@ void set_font() {
 
 void define_region_spi(int xstart, int ystart, int xend, int yend, int rw) {
     unsigned char coord[4];
+    // the window must not cross the wrap of the scroll area (see contiguous_rows())
+    yend = map_row(ystart) + (yend - ystart);
+    ystart = map_row(ystart);
     lcd_spi_lower_cs();
     gpio_put(Pico_LCD_DC, 0);
     hw_send_spi(&(uint8_t) {ILI9341_COLADDRSET}, 1);
@@ -133,7 +264,7 @@ void read_buffer_spi(int x1, int y1, int x2, int y2, unsigned char *p) {
     hw_read_spi((uint8_t *) p, N);
     gpio_put(Pico_LCD_DC, 0);
     lcd_spi_raise_cs();
-    spi_set_baudrate(Pico_LCD_SPI_MOD, LCD_SPI_SPEED);
+    spi_set_baudrate(Pico_LCD_SPI_MOD, lcd_spi_speed);
     r = 0;
 
     while (N) {
@@ -146,9 +277,55 @@ void read_buffer_spi(int x1, int y1, int x2, int y2, unsigned char *p) {
     }
 }
 
+#ifdef ILI9488
+#define LCD_BYTES_PER_PIXEL 3
+#else
+#define LCD_BYTES_PER_PIXEL 2
+#endif
+// Converted rows for draw_buffer_spi(); two so one can be filled while the other is sent
+static unsigned char lcd_row_buffer[2][LCD_WIDTH * LCD_BYTES_PER_PIXEL];
+
+// Convert RGB565 pixels into the panel format, two pixels per 32-bit load when aligned
+static void __not_in_flash_func(convert_rgb565_row)(const uint16_t *src, unsigned char *dst, int n) {
+    int i = 0;
+    if (((uintptr_t) src & 3) == 0) {
+        const uint32_t *words = (const uint32_t *) src;
+        for (; i + 1 < n; i += 2) {
+            uint32_t w = *words++;
+#ifdef ILI9488
+            // Scale each component to 8 bits, repeating its top bits in the new low bits
+            dst[0] = ((w >> 8) & 0xF8) | ((w >> 13) & 0x07);
+            dst[1] = ((w >> 3) & 0xFC) | ((w >> 9) & 0x03);
+            dst[2] = ((w << 3) & 0xF8) | ((w >> 2) & 0x07);
+            dst[3] = ((w >> 24) & 0xF8) | (w >> 29);
+            dst[4] = ((w >> 19) & 0xFC) | ((w >> 25) & 0x03);
+            dst[5] = ((w >> 13) & 0xF8) | ((w >> 18) & 0x07);
+            dst += 6;
+#else
+            dst[0] = w >> 8;
+            dst[1] = w;
+            dst[2] = w >> 24;
+            dst[3] = w >> 16;
+            dst += 4;
+#endif
+        }
+    }
+    for (; i < n; i++) {
+        uint16_t pixel = src[i];
+#ifdef ILI9488
+        *dst++ = ((pixel >> 8) & 0xF8) | (pixel >> 13);
+        *dst++ = ((pixel >> 3) & 0xFC) | ((pixel >> 9) & 0x03);
+        *dst++ = ((pixel << 3) & 0xF8) | ((pixel >> 2) & 0x07);
+#else
+        *dst++ = pixel >> 8;
+        *dst++ = pixel;
+#endif
+    }
+}
+
+// Draw a buffer of RGB565 pixels, converted row by row and streamed to the panel
 void draw_buffer_spi(int x1, int y1, int x2, int y2, unsigned char *p) {
-    int i, t;
-    unsigned char q[3];
+    int t;
     
     // Boundary checking
     if (x2 <= x1) {
@@ -170,39 +347,50 @@ void draw_buffer_spi(int x1, int y1, int x2, int y2, unsigned char *p) {
     if (y2 < 0) y2 = 0;
     if (y2 >= vres) y2 = vres - 1;
     
-    // Calculate total number of pixels
-    int pixelCount = (x2 - x1 + 1) * (y2 - y1 + 1);
-    uint16_t *pixelBuffer = (uint16_t *)p;
-    
-    define_region_spi(x1, y1, x2, y2, 1);
-    
-    for (i = 0; i < pixelCount; i++) {
-        uint16_t pixel = pixelBuffer[i];
-        
-        // Extract RGB565 components
-        uint8_t r5 = (pixel >> 11) & 0x1F;
-        uint8_t g6 = (pixel >> 5) & 0x3F;
-        uint8_t b5 = pixel & 0x1F;
-        
-        // Convert to 8-bit values (scaling approximation)
-        uint8_t r8 = (r5 << 3) | (r5 >> 2);
-        uint8_t g8 = (g6 << 2) | (g6 >> 4);
-        uint8_t b8 = (b5 << 3) | (b5 >> 2);
-        
-#ifdef ILI9488
-        // Convert each RGB565 pixel to RGB888 (3 bytes per pixel) for ILI9488
-        uint8_t rgb[3];
-        rgb[0] = r8;  // Red
-        rgb[1] = g8;  // Green
-        rgb[2] = b8;  // Blue
-        hw_send_spi(rgb, 3);
+    int width = x2 - x1 + 1;
+    int row_bytes = width * LCD_BYTES_PER_PIXEL;
+    const uint16_t *pixelBuffer = (const uint16_t *)p;
+    int row_index = 0;
+
+    // one window per part that is consecutive in the frame memory
+    for (int y = y1, rows; y <= y2; y += rows) {
+        rows = contiguous_rows(y, y2);
+        define_region_spi(x1, y, x2, y + rows - 1, 1);
+        for (int r = 0; r < rows; r++, pixelBuffer += width) {
+            unsigned char *row = lcd_row_buffer[row_index];
+            row_index ^= 1;
+            // the DMA may still be reading the other buffer, never this one
+            convert_rgb565_row(pixelBuffer, row, width);
+#if LCD_USE_DMA
+            lcd_dma_send_more(row, row_bytes);
 #else
-        // For other controllers or if using 16-bit mode, retain the original conversion
-        hw_send_spi(q, 2);
+            spi_write_fast(Pico_LCD_SPI_MOD, row, row_bytes);
+#endif
+        }
+#if !LCD_USE_DMA
+        spi_finish(Pico_LCD_SPI_MOD);
+        lcd_spi_raise_cs();
+#endif
+    }
+}
+
+// Send a ready-made RGB888 buffer (3 bytes per pixel, row by row) to a window that
+// must lie completely on screen. With LCD_USE_DMA the call returns before the transfer
+// has finished, so the buffer must not be changed before lcd_wait_idle().
+void draw_rgb888_spi(int x1, int y1, int x2, int y2, const unsigned char *p) {
+    if (x1 < 0 || y1 < 0 || x2 >= hres || y2 >= vres || x2 < x1 || y2 < y1) return;
+    uint32_t stride = (uint32_t) (x2 - x1 + 1) * 3;
+    for (int y = y1, rows; y <= y2; y += rows, p += rows * stride) {
+        rows = contiguous_rows(y, y2);
+        define_region_spi(x1, y, x2, y + rows - 1, 1);
+#if LCD_USE_DMA
+        lcd_dma_send(p, rows * stride);
+#else
+        spi_write_fast(Pico_LCD_SPI_MOD, p, rows * stride);
+        spi_finish(Pico_LCD_SPI_MOD);
+        lcd_spi_raise_cs();
 #endif
     }
-    
-    lcd_spi_raise_cs();
 }
 
 //Print the bitmap of a char on the video output
@@ -222,6 +410,13 @@ void draw_bitmap_spi(int x1, int y1, int width, int height, int scale, int fc, i
     } c;
 
     if (x1 >= hres || y1 >= vres || x1 + width * scale < 0 || y1 + height * scale < 0)return;
+#if LCD_USE_DMA
+    if (bc != -1 && x1 >= 0 && y1 >= 0 && x1 + width * scale <= hres && y1 + height * scale <= vres &&
+        width * scale * height * scale * 3 <= LCD_GLYPH_BUFFER_SIZE) {
+        lcd_dma_bitmap(x1, y1, width, height, scale, fc, bc, bitmap);
+        return;
+    }
+#endif
     // adjust when part of the bitmap is outside the displayable coordinates
     vertCoord = y1;
     if (y1 < 0) y1 = 0;                                 // the y coord is above the top of the screen
@@ -301,8 +496,11 @@ void draw_rect_spi(int x1, int y1, int x2, int y2, int c) {
 #endif
         hw_send_spi(col, 3);
     } else {
-        int i, t, y;
+        int t, y;
+#if !LCD_USE_DMA
+        int i;
         unsigned char *p;
+#endif
         // make sure the coordinates are kept within the display area
         if (x2 <= x1) {
             t = x1;
@@ -322,8 +520,8 @@ void draw_rect_spi(int x1, int y1, int x2, int y2, int c) {
         if (y1 >= vres) y1 = vres - 1;
         if (y2 < 0) y2 = 0;
         if (y2 >= vres) y2 = vres - 1;
-        define_region_spi(x1, y1, x2, y2, 1);
 #ifdef ILI9488
+#if !LCD_USE_DMA
         i = x2 - x1 + 1;
         i *= 3;
         p = lcd_buffer;
@@ -335,10 +533,23 @@ void draw_rect_spi(int x1, int y1, int x2, int y2, int c) {
             p[t + 1] = col[1];
             p[t + 2] = col[2];
         }
-        for (y = y1; y <= y2; y++) {
-            spi_write_fast(Pico_LCD_SPI_MOD, p, i);
+#endif
+        // one window per part of the rectangle that is consecutive in the frame memory
+        for (y = y1; y <= y2; y += t) {
+            t = contiguous_rows(y, y2);
+            define_region_spi(x1, y, x2, y + t - 1, 1);
+#if LCD_USE_DMA
+            lcd_dma_fill((uint32_t) (x2 - x1 + 1) * t, c);
+#else
+            for (int r = 0; r < t; r++) {
+                spi_write_fast(Pico_LCD_SPI_MOD, p, i);
+            }
+            spi_finish(Pico_LCD_SPI_MOD);
+            lcd_spi_raise_cs();
+#endif
         }
 #endif
+        return;
     }
     spi_finish(Pico_LCD_SPI_MOD);
     lcd_spi_raise_cs();
@@ -377,8 +588,46 @@ void lcd_print_char( int fc, int bc, char c, int orientation) {
 
 unsigned char scrollbuff[LCD_WIDTH * 3];
 
+void lcd_set_scroll_area(int top, int height) {
+    if (height <= 0 || top < 0 || top + height > LCD_FRAME_LINES) {
+        top = 0;
+        height = 0;
+    }
+    if (top == scroll_top && height == scroll_height && scroll_offset == 0) return;
+    scroll_top = top;
+    scroll_height = height;
+    scroll_offset = 0;
+    if (height == 0) {
+        // power-on default: the whole frame memory scrolls, at offset 0
+        top = 0;
+        height = LCD_FRAME_LINES;
+    }
+    int bottom = LCD_FRAME_LINES - top - height;
+    spi_write_cd(ILI9488_VSCRDEF, 6, top >> 8, top & 0xFF, height >> 8, height & 0xFF,
+                 bottom >> 8, bottom & 0xFF);
+    spi_write_cd(ILI9488_VSCRSADD, 2, top >> 8, top & 0xFF);
+}
+
+void lcd_scroll_area(int lines) {
+    if (scroll_height == 0) return;
+    lines %= scroll_height;
+    if (lines < 0) lines += scroll_height;
+    scroll_offset = (scroll_offset + lines) % scroll_height;
+    int start = scroll_top + scroll_offset;
+    spi_write_cd(ILI9488_VSCRSADD, 2, start >> 8, start & 0xFF);
+}
+
 void scroll_lcd_spi(int lines) {
     if (lines == 0)return;
+#if LCD_HW_SCROLL
+    // scroll the whole screen in hardware, then clear the lines that came into view
+    if (scroll_top != 0 || scroll_height != vres) lcd_set_scroll_area(0, vres);
+    lcd_scroll_area(lines);
+    if (lines > 0)
+        draw_rect_spi(0, vres - lines, hres - 1, vres - 1, gui_bcolour);
+    else
+        draw_rect_spi(0, 0, hres - 1, -lines - 1, gui_bcolour);
+#else
     if (lines >= 0) {
         for (int i = 0; i < vres - lines; i++) {
             read_buffer_spi(0, i + lines, hres - 1, i + lines, scrollbuff);
@@ -393,7 +642,7 @@ void scroll_lcd_spi(int lines) {
         }
         draw_rect_spi(0, 0, hres - 1, lines - 1, gui_bcolour); // erase the lines introduced at the top
     }
-
+#endif
 }
 
 void display_put_c(char c) {
@@ -444,8 +693,76 @@ char lcd_put_char(char c, int flush) {
     return c;
 }
 
+/******************************************************************************************
+ Whole-string text renderer
+ A run of printable characters that fits on the current line is expanded into one
+ scanline-ordered RGB888 buffer and sent as a single window. Each font row is one byte
+ (8 pixels wide, MSB first), so a row is copied from a 16 entry LUT of 4-pixel nibbles
+ built for the current foreground/background pair.
+*****************************************************************************************/
+static unsigned char lcd_text_buffer[LCD_WIDTH * LCD_TEXT_MAX_HEIGHT * 3];
+static unsigned char lcd_nibble_lut[16][12];
+static int lcd_lut_fc = -1, lcd_lut_bc = -1;
+
+static void build_nibble_lut(int fc, int bc) {
+    if (fc == lcd_lut_fc && bc == lcd_lut_bc) return;
+    for (int n = 0; n < 16; n++) {
+        for (int b = 0; b < 4; b++) {
+            int col = (n & (0x8 >> b)) ? fc : bc;
+            lcd_nibble_lut[n][b * 3] = col >> 16;
+            lcd_nibble_lut[n][b * 3 + 1] = (col >> 8) & 0xFF;
+            lcd_nibble_lut[n][b * 3 + 2] = col & 0xFF;
+        }
+    }
+    lcd_lut_fc = fc;
+    lcd_lut_bc = bc;
+}
+
+// Returns the number of characters drawn from s, 0 if the per-character path must be used
+static int lcd_blit_string(const char *s, int fc, int bc) {
+    const unsigned char *fp = MainFont;
+    int width = fp[0], height = fp[1];
+    int len = 0;
+
+    if (width != 8 || height > LCD_TEXT_MAX_HEIGHT || bc == -1) return 0;
+    if (current_x < 0 || current_y < 0 || current_y + height > vres) return 0;
+    while (s[len] && s[len] >= ' ' && current_x + (len + 1) * width <= hres) len++;
+    // leave single characters and line wrapping to display_put_c()
+    if (len < 2) return 0;
+
+    // the buffer may still be in flight from the previous string
+    lcd_wait_idle();
+    build_nibble_lut(fc, bc);
+
+    int stride = len * width * 3;
+    for (int i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        const unsigned char *glyph = NULL;
+        if (c >= fp[2] && c < fp[2] + fp[3])
+            glyph = fp + 4 + (c - fp[2]) * height;
+        unsigned char *out = lcd_text_buffer + i * width * 3;
+        for (int row = 0; row < height; row++, out += stride) {
+            unsigned char bits = glyph ? glyph[row] : 0; // not in the font: print a space
+            memcpy(out, lcd_nibble_lut[bits >> 4], 12);
+            memcpy(out + 12, lcd_nibble_lut[bits & 0x0F], 12);
+        }
+    }
+
+    draw_rgb888_spi(current_x, current_y, current_x + len * width - 1, current_y + height - 1, lcd_text_buffer);
+
+    current_x += len * width;
+    for (int i = 0; i < len; i++)
+        if (isprint((unsigned char) s[i])) lcd_char_pos++;
+    return len;
+}
+
 void lcd_print_string(char *s) {
     while (*s) {
+        int n = lcd_blit_string(s, gui_fcolour, gui_bcolour);
+        if (n) {
+            s += n;
+            continue;
+        }
         if (s[1])lcd_put_char(*s, 0);
         else lcd_put_char(*s, 1);
         s++;
@@ -461,6 +778,11 @@ void lcd_print_string_color(char *s, int fg, int bg) {
     gui_bcolour = bg;
 
     while (*s) {
+        int n = lcd_blit_string(s, fg, bg);
+        if (n) {
+            s += n;
+            continue;
+        }
         if (s[1]) lcd_put_char(*s, 0);
         else lcd_put_char(*s, 1);
         s++;
@@ -673,12 +995,13 @@ void lcd_set_cursor(int x, int y) {
 }
 
 void lcd_spi_lower_cs(void) {
-
+    lcd_wait_idle();
     gpio_put(Pico_LCD_CS, 0);
 
 }
 
 void spi_write_data(unsigned char data) {
+    lcd_wait_idle();
     gpio_put(Pico_LCD_DC, 1);
     lcd_spi_lower_cs();
     hw_send_spi(&data, 1);
@@ -692,6 +1015,7 @@ void spi_write_data24(uint32_t data) {
     data_array[2] = data & 0xFF;
 
 
+    lcd_wait_idle();
     gpio_put(Pico_LCD_DC, 1); // Data mode
     gpio_put(Pico_LCD_CS, 0);
     spi_write_blocking(Pico_LCD_SPI_MOD, data_array, 3);
@@ -699,6 +1023,7 @@ void spi_write_data24(uint32_t data) {
 }
 
 void spi_write_command(unsigned char data) {
+    lcd_wait_idle();
     gpio_put(Pico_LCD_DC, 0);
     gpio_put(Pico_LCD_CS, 0);
 
@@ -716,6 +1041,12 @@ void spi_write_cd(unsigned char command, int data, ...) {
     va_end(ap);
 }
 
+void lcd_set_spi_speed(uint32_t hz) {
+    lcd_wait_idle();
+    lcd_spi_speed = hz;
+    spi_set_baudrate(Pico_LCD_SPI_MOD, lcd_spi_speed);
+}
+
 void lcd_spi_init() {
     // init GPIO
     gpio_init(Pico_LCD_SCK);
@@ -732,7 +1063,7 @@ void lcd_spi_init() {
     gpio_set_dir(Pico_LCD_RST, GPIO_OUT);
 
     // init SPI
-    spi_init(Pico_LCD_SPI_MOD, LCD_SPI_SPEED);
+    spi_init(Pico_LCD_SPI_MOD, lcd_spi_speed);
     gpio_set_function(Pico_LCD_SCK, GPIO_FUNC_SPI);
     gpio_set_function(Pico_LCD_TX, GPIO_FUNC_SPI);
     gpio_set_function(Pico_LCD_RX, GPIO_FUNC_SPI);
@@ -740,6 +1071,11 @@ void lcd_spi_init() {
 
     gpio_put(Pico_LCD_CS, 1);
     gpio_put(Pico_LCD_RST, 1);
+
+#if LCD_USE_DMA
+    if (lcd_dma_chan < 0)
+        lcd_dma_chan = dma_claim_unused_channel(true);
+#endif
 }
 
 
@@ -4,9 +4,25 @@
 #include <hardware/spi.h>
 
 //#define LCD_SPI_SPEED   6000000
+#ifndef LCD_SPI_SPEED
 #define LCD_SPI_SPEED   25000000
+#endif
 //#define LCD_SPI_SPEED 50000000
 
+// Paint fills and glyphs through DMA, so drawing calls return while the
+// panel is still being written
+#ifndef LCD_USE_DMA
+#define LCD_USE_DMA 1
+#endif
+// Largest glyph (width * height * scale^2 * 3 bytes) sent through DMA
+#define LCD_GLYPH_BUFFER_SIZE 512
+// Scroll with the controller's vertical scrolling instead of reading the screen back
+#ifndef LCD_HW_SCROLL
+#define LCD_HW_SCROLL 1
+#endif
+// Tallest font drawn by the whole-string text renderer
+#define LCD_TEXT_MAX_HEIGHT 12
+
 #define Pico_LCD_SCK 10 //
 #define Pico_LCD_TX  11 // MOSI
 #define Pico_LCD_RX  12 // MISO
@@ -18,6 +34,8 @@
 #ifdef ILI9488
 #define LCD_WIDTH 320
 #define LCD_HEIGHT 320
+// Lines of frame memory the controller scrolls through (only LCD_HEIGHT are visible)
+#define LCD_FRAME_LINES 480
 #endif
 
 #define PIXFMT_BGR 1
@@ -29,6 +47,8 @@
 #define TFT_DISPOFF 0x28
 #define TFT_DISPON 0x29
 #define TFT_MADCTL 0x36
+#define ILI9488_VSCRDEF 0x33  // Vertical scrolling definition
+#define ILI9488_VSCRSADD 0x37 // Vertical scrolling start address
 
 #define ILI9341_MEMCONTROL 	0x36
 #define ILI9341_MADCTL_MX  	0x40
@@ -106,6 +126,8 @@ extern void hw_read_spi(unsigned char *buff, int cnt);
 extern void hw_send_spi(const unsigned char *buff, int cnt);
 extern unsigned char __not_in_flash_func(hw1_swap_spi)(unsigned char data_out);
 
+// Wait for a pending DMA transfer to the panel to finish and release CS
+extern void lcd_wait_idle(void);
 extern void lcd_spi_raise_cs(void);
 extern void lcd_spi_lower_cs(void);
 extern void spi_write_data(unsigned char data);
@@ -114,6 +136,7 @@ extern void spi_write_cd(unsigned char command, int data, ...);
 extern void spi_write_data24(uint32_t data);
 
 extern void spi_draw_pixel(uint16_t x, uint16_t y, uint16_t color) ;
+extern unsigned char *MainFont;
 extern void lcd_putc(uint8_t devn, uint8_t c);
 extern int  lcd_getc(uint8_t devn);
 extern void lcd_sleeping(uint8_t devn);
@@ -132,6 +155,18 @@ void lcd_print_string_color(char *s, int fg, int bg);
 //    bitmap - pointer to the bitmap
 void draw_bitmap_spi(int x1, int y1, int width, int height, int scale, int fc, int bc, unsigned char *bitmap);
 void draw_buffer_spi(int x1, int y1, int x2, int y2, unsigned char *p);
+void draw_rgb888_spi(int x1, int y1, int x2, int y2, const unsigned char *p);
+// Make screen rows top .. top + height - 1 a hardware scrolling area at offset 0
+// (height 0 restores the power-on default). Drawing keeps using screen coordinates.
+void lcd_set_scroll_area(int top, int height);
+// Scroll the area up by lines (down if negative); the rows that come into view at the
+// other end hold stale content and must be redrawn by the caller
+void lcd_scroll_area(int lines);
+// Scroll the whole screen up by lines (down if negative), clearing the rows that come into view
+void scroll_lcd_spi(int lines);
+// Change the write clock (LCD_SPI_SPEED by default); the actual rate is the
+// closest one at or below hz that clk_peri divides down to
+void lcd_set_spi_speed(uint32_t hz);
 
 
 extern char lcd_put_char(char c, int flush);
@@ -0,0 +1,303 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * lz4_image.c
+ *
+ * Streaming decompression of LZ4 compressed application images (.bin.lz4).
+ *
+ * Images typically compress 2-3x, so reading them from the card takes a
+ * fraction of the time. The file is a standard LZ4 frame as written by
+ * `lz4 --content-size`: the decompressed size must be in the frame header so
+ * it can be checked against the application area before anything is erased.
+ *
+ * The compressed data is read in SD_BOOT_LZ4_INPUT_SIZE chunks and decoded
+ * straight into the flash writer's staging buffer. No history window is kept:
+ * back-references are copied from the staging buffer, or read back through
+ * XIP from flash for data that has already been flushed, so linked blocks
+ * work as well as independent ones. The frame's checksums are skipped, the
+ * image digest in the boot state is taken over the flash after writing.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "config.h"
+#include "debug.h"
+#include "flash_writer.h"
+#include "lz4_image.h"
+#include "boot_trace.h"
+
+#define LZ4_MAGIC             0x184D2204u
+#define FLG_VERSION_MASK      0xC0
+#define FLG_VERSION           0x40
+#define FLG_BLOCK_CHECKSUM    0x10
+#define FLG_CONTENT_SIZE      0x08
+#define FLG_CONTENT_CHECKSUM  0x04
+#define FLG_DICT_ID           0x01
+#define BLOCK_UNCOMPRESSED    0x80000000u
+#define MIN_MATCH             4
+
+// Buffered reader over the compressed file
+typedef struct
+{
+    FILE *fp;
+    size_t pos, len;     // Read position and fill of buf
+    uint32_t consumed;   // Bytes consumed since the start of the frame
+    uint8_t buf[SD_BOOT_LZ4_INPUT_SIZE];
+} reader_t;
+
+// Decoder output: the flash writer, or the first len bytes into head
+typedef struct
+{
+    uint8_t *head;
+    size_t head_len;
+    uint32_t out;        // Bytes produced so far
+} sink_t;
+
+bool lz4_image_is_name(const char *name)
+{
+    size_t len = strlen(name), ext_len = strlen(LZ4_IMAGE_EXTENSION);
+    return len >= ext_len && strcmp(name + len - ext_len, LZ4_IMAGE_EXTENSION) == 0;
+}
+
+static bool refill(reader_t *r)
+{
+    r->pos = 0;
+    r->len = fread(r->buf, 1, sizeof(r->buf), r->fp);
+    BOOT_TRACE_ADD(TRACE_BYTES_READ, r->len);
+    return r->len > 0;
+}
+
+static int read_byte(reader_t *r)
+{
+    if (r->pos == r->len && !refill(r))
+        return -1;
+    r->consumed++;
+    return r->buf[r->pos++];
+}
+
+static bool read_u32(reader_t *r, uint32_t *value)
+{
+    *value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        int c = read_byte(r);
+        if (c < 0)
+            return false;
+        *value |= (uint32_t)c << (8 * i);
+    }
+    return true;
+}
+
+static bool skip(reader_t *r, size_t n)
+{
+    while (n-- > 0)
+    {
+        if (read_byte(r) < 0)
+            return false;
+    }
+    return true;
+}
+
+// Literal and match lengths of 15 continue in the following bytes
+static bool read_length(reader_t *r, size_t *len)
+{
+    int c;
+    do
+    {
+        if ((c = read_byte(r)) < 0)
+            return false;
+        *len += c;
+    } while (c == 255);
+    return true;
+}
+
+static bool sink_full(const sink_t *s)
+{
+    return s->head != NULL && s->out >= s->head_len;
+}
+
+// Pass n bytes from the input to the output
+static bool emit_literals(reader_t *r, sink_t *s, size_t n)
+{
+    while (n > 0 && !sink_full(s))
+    {
+        if (r->pos == r->len && !refill(r))
+            return false;
+        size_t k = r->len - r->pos;
+        if (k > n)
+            k = n;
+        if (s->head != NULL)
+        {
+            if (k > s->head_len - s->out)
+                k = s->head_len - s->out;
+            memcpy(s->head + s->out, r->buf + r->pos, k);
+        }
+        else if (!flash_writer_write(r->buf + r->pos, k))
+            return false;
+        r->pos += k;
+        r->consumed += k;
+        s->out += k;
+        n -= k;
+    }
+    return true;
+}
+
+static bool emit_match(sink_t *s, size_t distance, size_t n)
+{
+    if (s->head == NULL)
+    {
+        if (!flash_writer_repeat(distance, n))
+            return false;
+        s->out += n;
+        return true;
+    }
+
+    if (distance == 0 || distance > s->out)
+        return false;
+    for (; n > 0 && !sink_full(s); n--, s->out++)
+        s->head[s->out] = s->head[s->out - distance];
+    return true;
+}
+
+// Decode one compressed block of size bytes
+static bool decode_block(reader_t *r, sink_t *s, uint32_t size)
+{
+    uint32_t end = r->consumed + size;
+    while (r->consumed < end && !sink_full(s))
+    {
+        int token = read_byte(r);
+        if (token < 0)
+            return false;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(r, &literals))
+            return false;
+        if (!emit_literals(r, s, literals))
+            return false;
+
+        // The last sequence of a block has no match
+        if (r->consumed >= end || sink_full(s))
+            break;
+
+        int lo = read_byte(r), hi = read_byte(r);
+        if (lo < 0 || hi < 0)
+            return false;
+        size_t match = token & 15;
+        if (match == 15 && !read_length(r, &match))
+            return false;
+        if (!emit_match(s, (size_t)lo | ((size_t)hi << 8), match + MIN_MATCH))
+            return false;
+    }
+    return r->consumed == end || sink_full(s);
+}
+
+static bool read_header(reader_t *r, uint32_t *content_size, uint8_t *flg)
+{
+    uint32_t magic, size_lo, size_hi;
+    if (!read_u32(r, &magic) || magic != LZ4_MAGIC)
+        return false;
+
+    int c = read_byte(r);
+    if (c < 0 || (c & FLG_VERSION_MASK) != FLG_VERSION)
+        return false;
+    *flg = c;
+    if (!(*flg & FLG_CONTENT_SIZE) || (*flg & FLG_DICT_ID))
+    {
+        DEBUG_PRINT("lz4: content size required, no dictionary\n");
+        return false;
+    }
+
+    // Block descriptor byte, then the 64-bit content size
+    if (read_byte(r) < 0 || !read_u32(r, &size_lo) || !read_u32(r, &size_hi) || size_hi != 0)
+        return false;
+    *content_size = size_lo;
+
+    // Header checksum
+    return read_byte(r) >= 0;
+}
+
+static bool decode_frame(reader_t *r, sink_t *s, uint32_t *content_size)
+{
+    uint8_t flg;
+    if (!read_header(r, content_size, &flg))
+        return false;
+
+    while (!sink_full(s))
+    {
+        uint32_t block_size;
+        if (!read_u32(r, &block_size))
+            return false;
+        if (block_size == 0)
+            break; // End mark
+
+        bool ok = (block_size & BLOCK_UNCOMPRESSED)
+                      ? emit_literals(r, s, block_size & ~BLOCK_UNCOMPRESSED)
+                      : decode_block(r, s, block_size);
+        if (!ok || ((flg & FLG_BLOCK_CHECKSUM) && !skip(r, 4)))
+            return false;
+    }
+    return true;
+}
+
+static reader_t *reader_create(FILE *fp)
+{
+    reader_t *r = malloc(sizeof(reader_t));
+    if (r == NULL)
+    {
+        DEBUG_PRINT("lz4: out of memory\n");
+        return NULL;
+    }
+    r->fp = fp;
+    r->pos = r->len = 0;
+    r->consumed = 0;
+    return r;
+}
+
+bool lz4_image_peek(FILE *fp, uint32_t *content_size, uint8_t *head, size_t len)
+{
+    reader_t *r = reader_create(fp);
+    if (r == NULL)
+        return false;
+
+    bool ok;
+    if (head != NULL && len > 0)
+    {
+        sink_t s = {.head = head, .head_len = len};
+        ok = decode_frame(r, &s, content_size) && s.out >= len;
+    }
+    else
+    {
+        uint8_t flg;
+        ok = read_header(r, content_size, &flg);
+    }
+    free(r);
+    return ok;
+}
+
+bool lz4_image_decompress(FILE *fp)
+{
+    reader_t *r = reader_create(fp);
+    if (r == NULL)
+        return false;
+
+    sink_t s = {0};
+    uint32_t content_size = 0;
+    bool ok = decode_frame(r, &s, &content_size);
+    if (ok && s.out != content_size)
+    {
+        DEBUG_PRINT("lz4: %u bytes decoded, header says %u\n", (unsigned)s.out, (unsigned)content_size);
+        ok = false;
+    }
+    else if (!ok)
+    {
+        DEBUG_PRINT("lz4: malformed frame after %u bytes\n", (unsigned)s.out);
+    }
+    free(r);
+    return ok;
+}
@@ -0,0 +1,30 @@
+/*
+ * lz4_image.h
+ *
+ */
+
+#ifndef LZ4_IMAGE_H
+#define LZ4_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define LZ4_IMAGE_EXTENSION ".bin.lz4"
+
+// Check whether a file name has the compressed image suffix
+bool lz4_image_is_name(const char *name);
+
+// Parse the frame header of a compressed image at the current file position
+// and return its decompressed size. If head is given, the first len bytes of
+// the image are decompressed into it as well. Returns false for anything that
+// is not a single LZ4 frame with the content size in its header.
+bool lz4_image_peek(FILE *fp, uint32_t *content_size, uint8_t *head, size_t len);
+
+// Decompress the image at the current file position into the flash writer,
+// which must have been started. Returns false on a read error, a malformed
+// frame or if the output does not match the size in the header.
+bool lz4_image_decompress(FILE *fp);
+
+#endif // LZ4_IMAGE_H
@@ -13,15 +13,19 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
 #include "hardware/gpio.h"
 #include "hardware/clocks.h"
+#include "hardware/irq.h"
 #include "debug.h"
 #include "i2ckbd.h"
 #include "lcdspi.h"
 #include <hardware/flash.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <hardware/watchdog.h>
 #include "config.h"
 
@@ -30,15 +34,29 @@
 #include "filesystem/vfs.h"
 #include "text_directory_ui.h"
 #include "key_event.h"
+#include "flash_writer.h"
+#include "boot_state.h"
+#include "image_hash.h"
+#include "lz4_image.h"
+#include "uf2_image.h"
+#include "app_slot.h"
+#include "boot_trace.h"
+#include "clock_profile.h"
+#include "dir_listing.h"
+#include "sd_readahead.h"
 
 const uint LEDPIN = 25;
 
-// Vector and RAM offset
+// Vector, NVIC and RAM offset
 #if PICO_RP2040
 #define VTOR_OFFSET M0PLUS_VTOR_OFFSET
+#define NVIC_ICER_OFFSET M0PLUS_NVIC_ICER_OFFSET
+#define NVIC_ICPR_OFFSET M0PLUS_NVIC_ICPR_OFFSET
 #define MAX_RAM 0x20040000
 #elif PICO_RP2350
 #define VTOR_OFFSET M33_VTOR_OFFSET
+#define NVIC_ICER_OFFSET M33_NVIC_ICER0_OFFSET
+#define NVIC_ICPR_OFFSET M33_NVIC_ICPR0_OFFSET
 #define MAX_RAM 0x20080000
 #endif
 
@@ -48,16 +66,173 @@ bool sd_card_inserted(void)
     return !gpio_get(SD_DET_PIN);
 }
 
+static blockdevice_t *sd_create(uint32_t baudrate)
+{
+    return blockdevice_sd_create(spi0,
+                                 SD_MOSI_PIN,
+                                 SD_MISO_PIN,
+                                 SD_SCLK_PIN,
+                                 SD_CS_PIN,
+                                 baudrate,
+                                 true);
+}
+
+#if SD_SPI_BAUDRATE == 0 || SD_BOOT_READAHEAD_SIZE
+// Read the FAT boot sector: sector 0 when the card has no partition table,
+// otherwise the first sector of the first partition
+static bool sd_read_boot_sector(blockdevice_t *sd, uint8_t *buf)
+{
+    if (sd->read(sd, buf, 0, 512) != 0)
+        return false;
+    if (buf[510] != 0x55 || buf[511] != 0xAA)
+        return false;
+
+    // A volume boot record starts with a jump instruction, an MBR does not
+    if (buf[0] == 0xEB || buf[0] == 0xE9)
+        return true;
+
+    uint32_t lba = buf[0x1C6] | (buf[0x1C7] << 8) | (buf[0x1C8] << 16) | ((uint32_t)buf[0x1C9] << 24);
+    if (sd->read(sd, buf, (bd_size_t)lba * 512, 512) != 0)
+        return false;
+    return buf[510] == 0x55 && buf[511] == 0xAA;
+}
+#endif
+
+// Open the SD block device and pick its SPI clock: either the fixed
+// SD_SPI_BAUDRATE, or the fastest rate of SD_SPI_BAUD_LADDER that reads the
+// boot sector back identically to a read at SD_SPI_BAUD_SAFE, several times
+// in a row. Returns NULL while the card does not answer yet.
+static blockdevice_t *sd_negotiate_clock(uint32_t *baudrate)
+{
+#if SD_SPI_BAUDRATE
+    *baudrate = SD_SPI_BAUDRATE;
+    blockdevice_t *sd = sd_create(SD_SPI_BAUDRATE);
+    bool ready = sd->init(sd) == 0;
+    sd->deinit(sd);
+    if (!ready)
+    {
+        blockdevice_sd_free(sd);
+        return NULL;
+    }
+    return sd;
+#else
+    static const uint32_t ladder[] = {SD_SPI_BAUD_LADDER};
+    uint8_t reference[512];
+    uint8_t sector[512];
+
+    *baudrate = SD_SPI_BAUD_SAFE;
+    blockdevice_t *sd = sd_create(SD_SPI_BAUD_SAFE);
+    if (sd->init(sd) != 0)
+    {
+        sd->deinit(sd);
+        blockdevice_sd_free(sd);
+        return NULL;
+    }
+    bool readable = sd_read_boot_sector(sd, reference);
+    sd->deinit(sd);
+    if (!readable)
+    {
+        // Leave unreadable or unformatted cards to fs_init() at the safe rate
+        DEBUG_PRINT("SD clock: no boot sector, using safe rate\n");
+        return sd;
+    }
+
+    for (size_t i = 0; i < count_of(ladder); i++)
+    {
+        if (ladder[i] <= SD_SPI_BAUD_SAFE)
+            break;
+
+        blockdevice_t *fast = sd_create(ladder[i]);
+        bool stable = fast->init(fast) == 0;
+        for (int r = 0; stable && r < SD_SPI_VERIFY_READS; r++)
+        {
+            stable = sd_read_boot_sector(fast, sector) &&
+                     memcmp(sector, reference, sizeof(reference)) == 0;
+        }
+        fast->deinit(fast);
+
+        DEBUG_PRINT("SD clock: %lu Hz %s\n", (unsigned long)ladder[i], stable ? "ok" : "failed");
+        if (stable)
+        {
+            blockdevice_sd_free(sd);
+            *baudrate = ladder[i];
+            return fast;
+        }
+        blockdevice_sd_free(fast);
+    }
+    return sd;
+#endif
+}
+
+// The card, its readahead wrapper and the filesystem mounted on /sd, released
+// before a new card is mounted
+static blockdevice_t *mounted_card = NULL;
+#if SD_BOOT_READAHEAD_SIZE
+static blockdevice_t *mounted_readahead = NULL;
+#endif
+static filesystem_t *mounted_fat = NULL;
+
+static void fs_release(void)
+{
+    if (mounted_fat != NULL)
+    {
+        fs_unmount("/sd");
+        filesystem_fat_free(mounted_fat);
+        mounted_fat = NULL;
+    }
+#if SD_BOOT_READAHEAD_SIZE
+    if (mounted_readahead != NULL)
+    {
+        sd_readahead_free(mounted_readahead);
+        mounted_readahead = NULL;
+    }
+#endif
+    if (mounted_card != NULL)
+    {
+        blockdevice_sd_free(mounted_card);
+        mounted_card = NULL;
+    }
+}
+
+#if SD_BOOT_READAHEAD_SIZE
+static bool is_power_of_two(uint32_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+#endif
+
 bool fs_init(void)
 {
     DEBUG_PRINT("fs init SD\n");
-    blockdevice_t *sd = blockdevice_sd_create(spi0,
-                                              SD_MOSI_PIN,
-                                              SD_MISO_PIN,
-                                              SD_SCLK_PIN,
-                                              SD_CS_PIN,
-                                              125000000 / 2 / 4, // 15.6MHz
-                                              true);
+
+    // Called again after the card was swapped: drop the old one first
+    fs_release();
+
+    // Poll the card until it answers, with a short growing backoff, rather
+    // than waiting a fixed time for it to power up
+    uint32_t baudrate;
+    uint32_t backoff_ms = SD_READY_RETRY_MS;
+    absolute_time_t deadline = make_timeout_time_ms(SD_READY_TIMEOUT_MS);
+    blockdevice_t *sd;
+    while ((sd = sd_negotiate_clock(&baudrate)) == NULL)
+    {
+        if (time_reached(deadline) || !sd_card_inserted())
+        {
+            DEBUG_PRINT("SD card not ready\n");
+            return false;
+        }
+        BOOT_TRACE_ADD(TRACE_SD_RETRIES, 1);
+        sleep_ms(backoff_ms);
+        if (backoff_ms < 100)
+            backoff_ms *= 2;
+    }
+    DEBUG_PRINT("SD clock: %lu Hz requested\n", (unsigned long)baudrate);
+    mounted_card = sd;
+#if SD_BOOT_READAHEAD_SIZE
+    mounted_readahead = sd_readahead_create(sd);
+    if (mounted_readahead != NULL)
+        sd = mounted_readahead;
+#endif
     filesystem_t *fat = filesystem_fat_create();
     int err = fs_mount("/sd", fat, sd);
     if (err == -1)
@@ -67,46 +242,126 @@ bool fs_init(void)
         if (err == -1)
         {
             DEBUG_PRINT("format err: %s\n", strerror(errno));
+            filesystem_fat_free(fat);
+            fs_release();
             return false;
         }
         err = fs_mount("/sd", fat, sd);
         if (err == -1)
         {
             DEBUG_PRINT("mount err: %s\n", strerror(errno));
+            filesystem_fat_free(fat);
+            fs_release();
             return false;
         }
     }
+    mounted_fat = fat;
+
+#if SD_BOOT_READAHEAD_SIZE
+    // Read ahead one cluster: bytes per sector times sectors per cluster, if
+    // the boot sector holds a plausible BPB
+    uint8_t boot[512];
+    if (mounted_readahead != NULL && sd_read_boot_sector(mounted_card, boot))
+    {
+        uint32_t sector = boot[0x0B] | (boot[0x0C] << 8);
+        uint32_t sectors = boot[0x0D];
+        if (sector >= 512 && sector <= 4096 && is_power_of_two(sector) && is_power_of_two(sectors))
+        {
+            sd_readahead_set_window(mounted_readahead, sector * sectors);
+            DEBUG_PRINT("SD readahead: %u byte clusters\n", (unsigned)(sector * sectors));
+        }
+    }
+#endif
     return true;
 }
 
-static bool __not_in_flash_func(is_same_existing_program)(FILE *fp)
+#if !SD_BOOT_DIFF_FLASH
+// Compare the file against the application already in flash.
+// The file content must match byte for byte, and the flash past the end of
+// the file must be erased: the rest of the last sector, plus the following
+// sector which load_program() always leaves blank. Without the tail check a
+// shorter file that is a prefix of the flashed image would falsely match.
+static bool __not_in_flash_func(is_same_existing_program)(FILE *fp, size_t file_size, uint32_t flash_offset)
 {
     uint8_t buffer[FLASH_SECTOR_SIZE] = {0};
     size_t program_size = 0;
     size_t len = 0;
     while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0)
     {
-        uint8_t *flash = (uint8_t *)(XIP_BASE + SD_BOOT_FLASH_OFFSET + program_size);
+        BOOT_TRACE_ADD(TRACE_BYTES_READ, len);
+        if (program_size + len > file_size)
+            return false;
+        uint8_t *flash = (uint8_t *)(XIP_BASE + flash_offset + program_size);
         if (memcmp(buffer, flash, len) != 0)
             return false;
         program_size += len;
     }
+    if (program_size != file_size)
+        return false;
+
+    // Remainder of the last sector, byte by byte since it may be unaligned
+    size_t sector_end = (file_size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    const uint8_t *tail = (const uint8_t *)(XIP_BASE + flash_offset);
+    for (size_t i = file_size; i < sector_end; i++)
+    {
+        if (tail[i] != 0xFF)
+            return false;
+    }
+
+    // Terminating blank sector
+    if (sector_end < SD_BOOT_APP_SLOT_SIZE && !flash_writer_is_erased(flash_offset + sector_end, FLASH_SECTOR_SIZE))
+        return false;
     return true;
 }
+#endif
+
+// Identity of a firmware file for the slot table: its size and modification time
+static uint32_t file_mtime(const char *filename)
+{
+    struct stat st;
+    return stat(filename, &st) == 0 ? (uint32_t)st.st_mtime : 0;
+}
+
+// Record the image now in a slot, with its digest, in the boot state
+static void record_image(int slot, const char *filename, uint32_t file_size, uint32_t image_size)
+{
+    boot_image_t image = {
+        .file_size = file_size,
+        .file_mtime = file_mtime(filename),
+        .image_size = image_size,
+    };
+    if (image_hash_flash(app_slot_offset(slot), image_size, &image.image_hash))
+        boot_state_record_image(slot, filename, &image);
+}
+
+bool is_valid_application(uint32_t *app_location);
+static bool is_verified_application(int slot);
+
+// Read the first two vectors of an image file at its current position: from
+// the decompressed content of a .bin.lz4, the first block payload of a .uf2,
+// the raw bytes otherwise. *image_size is updated where the header tells it.
+static bool read_image_head(FILE *fp, const char *filename, uint32_t vectors[2], uint32_t *image_size)
+{
+    if (lz4_image_is_name(filename))
+        return lz4_image_peek(fp, image_size, (uint8_t *)vectors, 2 * sizeof(uint32_t));
+    if (uf2_image_is_name(filename))
+        return uf2_image_peek(fp, image_size, (uint8_t *)vectors, 2 * sizeof(uint32_t));
+    return fread(vectors, 1, 2 * sizeof(uint32_t), fp) == 2 * sizeof(uint32_t);
+}
 
+// Load a firmware file into an application slot, or find it already resident
+// in one. The slot is returned in *slot, -1 if the file is not a valid image
+// (the flash is then untouched).
 // This function must run from RAM since it erases and programs flash memory
-static bool __not_in_flash_func(load_program)(const char *filename)
+static bool __not_in_flash_func(load_program)(const char *filename, int *slot)
 {
+    BOOT_TRACE_MARK("load start");
     FILE *fp = fopen(filename, "r");
     if (fp == NULL)
     {
         DEBUG_PRINT("open %s fail: %s\n", filename, strerror(errno));
         return false;
     }
-    if (is_same_existing_program(fp))
-    {
-        // Program is up to date
-    }
 
     // Check file size to ensure it doesn't exceed the available flash space
     if (fseek(fp, 0, SEEK_END) == -1)
@@ -124,43 +379,164 @@ static bool __not_in_flash_func(load_program)(const char *filename)
         return false;
     }
 
-    if (file_size > MAX_APP_SIZE)
+    if (fseek(fp, 0, SEEK_SET) == -1)
+    {
+        DEBUG_PRINT("seek err: %s\n", strerror(errno));
+        fclose(fp);
+        return false;
+    }
+
+    // Loaded before and still intact in its slot: nothing to read or write
+    int resident = boot_state_find_image(filename, (uint32_t)file_size, file_mtime(filename));
+    if (resident >= 0 && is_verified_application(resident))
     {
-        DEBUG_PRINT("file too large: %ld > %d\n", file_size, MAX_APP_SIZE);
+        DEBUG_PRINT("resident in slot %d\n", resident);
+        BOOT_TRACE_MARK("resident");
+        text_directory_ui_set_status("STAT: app resident in flash");
+        boot_state_record_launch(resident);
+        *slot = resident;
         fclose(fp);
+        return true;
+    }
+
+    // The vector table tells which slot the image is linked for. For a
+    // compressed image the decompressed size from its header counts, a UF2
+    // image has each of its blocks checked against the slot instead.
+    uint32_t vectors[2];
+    uint32_t image_size = (uint32_t)file_size;
+    bool compressed = lz4_image_is_name(filename);
+    bool uf2 = uf2_image_is_name(filename);
+    bool head_ok = read_image_head(fp, filename, vectors, &image_size);
+
+    int link_slot = head_ok && is_valid_application(vectors) ? app_slot_linked_for(vectors) : -1;
+    if (link_slot < 0 || fseek(fp, 0, SEEK_SET) == -1)
+    {
+        DEBUG_PRINT("not a valid image: %s\n", filename);
+        fclose(fp);
+        *slot = -1;
+        return false;
+    }
+
+    if (!uf2 && (image_size == 0 || image_size > SD_BOOT_APP_SLOT_SIZE))
+    {
+        DEBUG_PRINT("invalid image size: %u (max %d)\n", (unsigned)image_size, SD_BOOT_APP_SLOT_SIZE);
+        fclose(fp);
+        *slot = -1;
         return false;
     }
 
-    DEBUG_PRINT("updating: %ld bytes\n", file_size);
+    // A position specific build goes to its own slot. One linked for slot 0
+    // replaces an older version of the same file, so the stale copy does not
+    // keep a slot and the differential write has something to compare with,
+    // otherwise the least recently launched image where it can be mapped.
+    int target = link_slot;
+#if APP_SLOT_TRANSLATION
+    if (link_slot == 0)
+    {
+        target = boot_state_find_path(filename);
+        if (target < 0)
+            target = boot_state_lru_slot();
+    }
+#endif
+    uint32_t flash_offset = app_slot_offset(target);
+    *slot = target;
+
+#if !SD_BOOT_DIFF_FLASH
+    // Only a plain image can be compared with the flash as it is read
+    if (!compressed && !uf2 && is_same_existing_program(fp, (size_t)file_size, flash_offset))
+    {
+        // Program is up to date, skip the erase/program cycle
+        DEBUG_PRINT("program up to date\n");
+        BOOT_TRACE_MARK("compare done");
+        text_directory_ui_set_status("STAT: app up to date");
+        record_image(target, filename, (uint32_t)file_size, image_size);
+        fclose(fp);
+        return true;
+    }
+
     if (fseek(fp, 0, SEEK_SET) == -1)
     {
         DEBUG_PRINT("seek err: %s\n", strerror(errno));
         fclose(fp);
         return false;
     }
+#endif
 
-    size_t program_size = 0;
-    uint8_t buffer[FLASH_SECTOR_SIZE] = {0};
-    size_t len = 0;
+    DEBUG_PRINT("updating slot %d: %u bytes%s\n", target, (unsigned)image_size,
+                compressed ? " (lz4)" : uf2 ? " (uf2)" : "");
 
-    // Erase and program flash in FLASH_SECTOR_SIZE chunks
-    while ((len = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    if (!flash_writer_begin(flash_offset, SD_BOOT_APP_SLOT_SIZE))
+    {
+        fclose(fp);
+        return false;
+    }
+
+    if (compressed)
     {
-        // Ensure we don't write beyond the application area
-        if ((program_size + len) > MAX_APP_SIZE)
+        if (!lz4_image_decompress(fp))
         {
-            DEBUG_PRINT("err: write beyond app area\n");
+            flash_writer_abort();
             fclose(fp);
             return false;
         }
+    }
+    else if (uf2)
+    {
+        if (!uf2_image_load(fp, XIP_BASE + app_slot_offset(link_slot), SD_BOOT_APP_SLOT_SIZE, &image_size))
+        {
+            flash_writer_abort();
+            fclose(fp);
+            return false;
+        }
+    }
+    else
+    {
+        // Read straight into the flash writer's staging buffer, which is
+        // flushed to flash every time it fills up
+        while (true)
+        {
+            size_t space;
+            uint8_t *dst = flash_writer_reserve(&space);
+            size_t len = fread(dst, 1, space, fp);
+            if (len == 0)
+                break;
+            BOOT_TRACE_ADD(TRACE_BYTES_READ, len);
+            if (!flash_writer_commit(len))
+            {
+                flash_writer_abort();
+                fclose(fp);
+                return false;
+            }
+        }
+    }
 
-        uint32_t ints = save_and_disable_interrupts();
-        flash_range_erase(SD_BOOT_FLASH_OFFSET + program_size, FLASH_SECTOR_SIZE);
-        flash_range_program(SD_BOOT_FLASH_OFFSET + program_size, buffer, len);
-        restore_interrupts(ints);
+    if (ferror(fp))
+    {
+        DEBUG_PRINT("read err: %s\n", strerror(errno));
+        flash_writer_abort();
+        fclose(fp);
+        return false;
+    }
 
-        program_size += len;
+    flash_writer_stats_t stats;
+    flash_writer_finish(&stats);
+    BOOT_TRACE_MARK("flash written");
+    record_image(target, filename, (uint32_t)file_size, image_size);
+
+    char status_message[64];
+    if (stats.sectors_written == 0)
+    {
+        DEBUG_PRINT("program up to date\n");
+        snprintf(status_message, sizeof(status_message), "STAT: app up to date");
+    }
+    else
+    {
+        DEBUG_PRINT("%d of %d sectors rewritten, %d block erases\n",
+                    stats.sectors_written, stats.sectors_total, stats.blocks_erased);
+        snprintf(status_message, sizeof(status_message), "STAT: %d of %d sectors rewritten",
+                 stats.sectors_written, stats.sectors_total);
     }
+    text_directory_ui_set_status(status_message);
     DEBUG_PRINT("program loaded\n");
     fclose(fp);
     return true;
@@ -183,11 +559,13 @@ void __not_in_flash_func(launch_application_from)(uint32_t *app_location)
 }
 
 // Check if a valid application exists in flash by examining the vector table
-static bool is_valid_application(uint32_t *app_location)
+// (also used by the file browser on the first bytes of image files)
+bool is_valid_application(uint32_t *app_location)
 {
-    // Check that the initial stack pointer is within a plausible RAM region (assumed range for Pico: 0x20000000 to 0x20040000)
+    // Check that the initial stack pointer is within the SRAM. The SDK's linker
+    // scripts put it at the top of SCRATCH_Y (SRAM_END), above the main SRAM.
     uint32_t stack_pointer = app_location[0];
-    if (stack_pointer < 0x20000000 || stack_pointer > MAX_RAM)
+    if (stack_pointer < SRAM_BASE || stack_pointer > SRAM_END)
     {
         return false;
     }
@@ -201,19 +579,172 @@ static bool is_valid_application(uint32_t *app_location)
     return true;
 }
 
+// Check for an image linked to run from SRAM (PICO_NO_FLASH builds, loaded
+// at the start of SRAM): the stack pointer lies in the SRAM, normally at the
+// top of SCRATCH_Y, the reset vector points into the main SRAM, and the image
+// of size bytes must fit below MAX_RAM
+bool is_ram_application(const uint32_t *vectors, uint32_t size)
+{
+    if (vectors[0] < SRAM_BASE || vectors[0] > SRAM_END)
+        return false;
+    if (vectors[1] < SRAM_BASE || vectors[1] >= MAX_RAM)
+        return false;
+    return size > 0 && size <= MAX_RAM - SRAM_BASE;
+}
+
+// Check the application in a slot against the boot state record: it must have
+// been written completely and still match the recorded digest, which catches
+// a load torn by a power loss
+static bool is_verified_application(int slot)
+{
+    boot_image_t image;
+    image_hash_t actual;
+    if (!boot_state_get_image(slot, &image))
+        return false;
+    if (!image_hash_flash(app_slot_offset(slot), image.image_size, &actual))
+        return false;
+    return memcmp(&image.image_hash, &actual, sizeof(actual)) == 0;
+}
+
+// Launch the image in a slot, mapping it over the application area first if
+// it is linked for slot 0. Nothing in flash may be called after the mapping.
+static void __not_in_flash_func(launch_slot)(int slot)
+{
+    uint32_t *vector_table = app_slot_vector_table(slot);
+    app_slot_map(slot);
+    launch_application_from(vector_table);
+}
+
+// Allow printf and the status line to complete and hand over the hardware
+static void prepare_launch(void)
+{
+    BOOT_TRACE_MARK("launch");
+    BOOT_TRACE_REPORT();
+    uart_tx_wait_blocking(uart0);
+    // No keyboard timer interrupt may fire into the application
+    keypad_deinit();
+    // Hand the panel over unscrolled
+    lcd_set_scroll_area(0, 0);
+    lcd_wait_idle();
+    clock_profile_restore();
+}
+
+#if SD_BOOT_RAM_LAUNCH
+// Last step of a RAM launch: move the image from its buffer down to the start
+// of SRAM and jump to it. This runs from scratch X, above the main SRAM that
+// is overwritten, with its stack in scratch Y. The buffer always lies above
+// the destination, so a forward copy is safe; volatile keeps the compiler from
+// calling memcpy, which may be overwritten. The image starts with interrupts
+// enabled as after a reset, every NVIC interrupt disabled and none pending.
+static void __scratch_x("ram_launch") __attribute__((noinline, noreturn))
+    start_ram_image(const uint32_t *src, size_t words)
+{
+    asm volatile("cpsid i" ::: "memory");
+    volatile uint32_t *dst = (volatile uint32_t *)SRAM_BASE;
+    for (size_t i = 0; i < words; i++)
+        dst[i] = src[i];
+
+    volatile uint32_t *icer = (uint32_t *)(PPB_BASE + NVIC_ICER_OFFSET);
+    volatile uint32_t *icpr = (uint32_t *)(PPB_BASE + NVIC_ICPR_OFFSET);
+    for (int i = 0; i < (NUM_IRQS + 31) / 32; i++)
+    {
+        icer[i] = 0xffffffff;
+        icpr[i] = 0xffffffff;
+    }
+
+    volatile uint32_t *vtor = (uint32_t *)(PPB_BASE + VTOR_OFFSET);
+    *vtor = SRAM_BASE;
+    asm volatile("cpsie i" ::: "memory");
+    asm volatile(
+        "msr msp, %0\n"
+        "bx %1\n"
+        :
+        : "r"(dst[0]), "r"(dst[1])
+        :);
+    __builtin_unreachable();
+}
+
+// Start an image built to run from SRAM without writing the flash: the file is
+// read into a heap buffer and moved into place at launch. Returns only if the
+// file is not such an image or cannot be loaded.
+static void launch_ram_image(const char *path)
+{
+    if (lz4_image_is_name(path) || uf2_image_is_name(path))
+        return;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return;
+
+    uint32_t vectors[2];
+    bool is_ram = fread(vectors, 1, sizeof(vectors), fp) == sizeof(vectors) &&
+                  fseek(fp, 0, SEEK_END) == 0;
+    long file_size = is_ram ? ftell(fp) : 0;
+    if (!is_ram || !is_ram_application(vectors, file_size > 0 ? (uint32_t)file_size : 0) ||
+        fseek(fp, 0, SEEK_SET) == -1)
+    {
+        fclose(fp);
+        return;
+    }
+
+    DEBUG_PRINT("RAM image: %ld bytes\n", file_size);
+    size_t words = ((size_t)file_size + 3) / 4;
+    uint32_t *buffer = malloc(words * 4);
+    if (buffer == NULL)
+    {
+        DEBUG_PRINT("RAM image: not enough free RAM\n");
+        text_directory_ui_set_status("ERR: not enough RAM for image");
+        fclose(fp);
+        sleep_ms(2000);
+        return;
+    }
+
+    size_t len = fread(buffer, 1, (size_t)file_size, fp);
+    fclose(fp);
+    BOOT_TRACE_ADD(TRACE_BYTES_READ, len);
+    if (len != (size_t)file_size)
+    {
+        DEBUG_PRINT("RAM image: read err\n");
+        free(buffer);
+        return;
+    }
+
+    text_directory_ui_set_status("STAT: launching from RAM...");
+    prepare_launch();
+    start_ram_image(buffer, words);
+}
+#endif
+
 int load_firmware_by_path(const char *path)
 {
     text_directory_ui_set_status("STAT: loading app...");
 
+#if SD_BOOT_RAM_LAUNCH
+    // Images built to run from SRAM are started without touching the flash
+    launch_ram_image(path);
+#endif
+
     // Attempt to load the application from the SD card
     // bool load_success = load_program(FIRMWARE_PATH);
-    bool load_success = load_program(path);
+    int slot = 0;
+    bool load_success = load_program(path, &slot);
+    if (slot < 0)
+    {
+        // Rejected before anything was written: report it rather than start
+        // whatever else is in flash
+        text_directory_ui_set_status("ERR: not a valid firmware image");
+        sleep_ms(2000);
+        return -1;
+    }
+    if (!load_success)
+        slot = boot_state_get_last_slot();
 
-    // Get the pointer to the application flash area
-    uint32_t *app_location = (uint32_t *)(XIP_BASE + SD_BOOT_FLASH_OFFSET);
+    // Get the pointer to the slot's flash area
+    uint32_t *app_location = (uint32_t *)(XIP_BASE + app_slot_offset(slot));
 
-    // Check if there is an already valid application in flash
-    bool has_valid_app = is_valid_application(app_location);
+    // Check if there is an already valid application in flash, and that it
+    // was not left half written by this or an earlier load
+    bool has_valid_app = is_valid_application(app_location) && is_verified_application(slot);
 
 
 
@@ -221,9 +752,8 @@ int load_firmware_by_path(const char *path)
     {
         text_directory_ui_set_status("STAT: launching app...");
         DEBUG_PRINT("launching app\n");
-        // Small delay to allow printf to complete
-        sleep_ms(100);
-        launch_application_from(app_location);
+        prepare_launch();
+        launch_slot(slot);
     }
     else
     {
@@ -243,6 +773,80 @@ int load_firmware_by_path(const char *path)
     }
 }
 
+#if SD_BOOT_FAST_LAUNCH
+// Launch the application already in flash without touching the SD card or
+// the LCD, if it was written completely and passes verification. Returns true
+// if a key was pressed to ask for the menu.
+static bool try_fast_launch(void)
+{
+    int slot = boot_state_get_last_slot();
+    uint32_t *app_location = (uint32_t *)(XIP_BASE + app_slot_offset(slot));
+    if (!is_valid_application(app_location) || !is_verified_application(slot))
+        return false;
+
+    DEBUG_PRINT("fast launch: verified app in slot %d\n", slot);
+    // A key held down at power-up is reported by the next complete poll; the
+    // one already under way when the loop starts may have begun too early
+    uint32_t reads = i2c_kbd_reads();
+    absolute_time_t deadline = make_timeout_time_ms(SD_BOOT_FAST_LAUNCH_WINDOW_MS);
+    bool done;
+    do
+    {
+        // Taken before the queue is looked at, so a key from the last poll is seen
+        done = time_reached(deadline) || i2c_kbd_reads() - reads >= 2;
+        if (keypad_get_key() != 0)
+        {
+            DEBUG_PRINT("fast launch cancelled\n");
+            return true;
+        }
+    } while (!done);
+
+    BOOT_TRACE_MARK("fast launch");
+    prepare_launch();
+    launch_slot(slot);
+    return false;
+}
+#endif
+
+#if SD_BOOT_AUTOBOOT
+// Check that a firmware file exists and its image starts with a plausible
+// vector table, decoded the same way load_program reads it
+static bool is_valid_application_file(const char *path)
+{
+    uint32_t vectors[2];
+    uint32_t image_size = 0;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return false;
+    bool head_ok = read_image_head(fp, path, vectors, &image_size);
+    fclose(fp);
+    return head_ok && is_valid_application(vectors);
+}
+
+// Relaunch the last used firmware unless a key is pressed within the
+// autoboot window. Returns only if the menu should be shown instead.
+static void try_autoboot(void)
+{
+    char path[256];
+    if (!boot_state_get_last_path(path, sizeof(path)) || !is_valid_application_file(path))
+        return;
+
+    DEBUG_PRINT("autoboot: %s\n", path);
+    text_directory_ui_set_status("Autoboot... press any key for menu");
+    absolute_time_t deadline = make_timeout_time_ms(SD_BOOT_AUTOBOOT_WINDOW_MS);
+    while (!time_reached(deadline))
+    {
+        if (keypad_get_key() != 0)
+        {
+            DEBUG_PRINT("autoboot cancelled\n");
+            text_directory_ui_set_status("Autoboot cancelled");
+            return;
+        }
+    }
+    load_firmware_by_path(path);
+}
+#endif
+
 void final_selection_callback(const char *path)
 {
     // Trigger firmware loading with the selected path
@@ -253,7 +857,8 @@ void final_selection_callback(const char *path)
     size_t path_len = strlen(path);
     size_t ext_len = strlen(extension);
 
-    if (path_len < ext_len || strcmp(path + path_len - ext_len, extension) != 0)
+    if ((path_len < ext_len || strcmp(path + path_len - ext_len, extension) != 0) &&
+        !lz4_image_is_name(path) && !uf2_image_is_name(path))
     {
         DEBUG_PRINT("not a bin: %s\n", path);
         snprintf(status_message, sizeof(status_message), "Err: FILE is not a .bin file");
@@ -269,27 +874,27 @@ void final_selection_callback(const char *path)
     load_firmware_by_path(path);
 }
 
-int main()
+// Bring up the LCD. With SD_BOOT_PARALLEL_INIT this runs on core1 and
+// signals through the FIFO when the panel is ready.
+static void lcd_bring_up(void)
 {
-    char buf[64];
-    stdio_init_all();
-
-    uart_init(uart0, 115200);
-    uart_set_format(uart0, 8, 1, UART_PARITY_NONE); // 8-N-1
-    uart_set_fifo_enabled(uart0, false);
-
-    // Initialize SD card detection pin
-    gpio_init(SD_DET_PIN);
-    gpio_set_dir(SD_DET_PIN, GPIO_IN);
-    gpio_pull_up(SD_DET_PIN); // Enable pull-up resistor
-
-    keypad_init();
     lcd_init();
+#if SD_BOOT_TURBO
+    lcd_set_spi_speed(SD_BOOT_TURBO_LCD_SPI_SPEED);
+#endif
     lcd_clear();
-    text_directory_ui_init();
-    
+#if SD_BOOT_PARALLEL_INIT
+    // Core0 resets core1 on this signal: let the clear's DMA fill finish here
+    lcd_wait_idle();
+    multicore_fifo_push_blocking(1);
+#endif
+}
+
+// Wait for a card with the status shown on screen and mount it, rebooting
+// if that fails
+static void mount_sd_card(void)
+{
     // Check for SD card presence
-    DEBUG_PRINT("Checking for SD card...\n");
     if (!sd_card_inserted())
     {
         DEBUG_PRINT("SD card not detected\n");
@@ -301,18 +906,15 @@ int main()
             sleep_ms(100);
         }
         
-        // Card detected, wait for it to stabilize
         DEBUG_PRINT("SD card detected\n");
         text_directory_ui_set_status("SD card detected. Mounting...");
-        sleep_ms(1500); // Wait for card to stabilize
-    }
-    else
-    {
-        // If SD card is detected at boot, wait for stabilization
-        DEBUG_PRINT("SD card stabilization delay on boot\n");
-        text_directory_ui_set_status("Stabilizing SD card...");
-        sleep_ms(1500); // Delay to allow the SD card to fully power up and stabilize
     }
+
+    // fs_init() polls the card until it is ready, any extra settling time
+    // is optional
+    if (SD_STABILIZE_MS > 0)
+        sleep_ms(SD_STABILIZE_MS);
+    BOOT_TRACE_MARK("sd detect");
     
     // Initialize filesystem
     if (!fs_init())
@@ -322,11 +924,81 @@ int main()
         sleep_ms(2000);
         watchdog_reboot(0, 0, 0);
     }
-    
-    sleep_ms(500);
-    lcd_clear();
-    
+    BOOT_TRACE_MARK("fs init");
+}
+
+int main()
+{
+    char buf[64];
+    // Before anything derives a divider from clk_sys or clk_peri
+    clock_profile_turbo();
+    stdio_init_all();
+    BOOT_TRACE_MARK("stdio init");
+
+    uart_init(uart0, 115200);
+    uart_set_format(uart0, 8, 1, UART_PARITY_NONE); // 8-N-1
+    uart_set_fifo_enabled(uart0, false);
+
+    // Initialize SD card detection pin
+    gpio_init(SD_DET_PIN);
+    gpio_set_dir(SD_DET_PIN, GPIO_IN);
+    gpio_pull_up(SD_DET_PIN); // Enable pull-up resistor
+
+    keypad_init();
+    BOOT_TRACE_MARK("keypad init");
+
+    // A key pressed during the fast launch window also skips the autoboot
+    __unused bool menu_requested = false;
+#if SD_BOOT_FAST_LAUNCH
+    menu_requested = try_fast_launch();
+    BOOT_TRACE_MARK("fast launch check");
+#endif
+
+    bool mounted = false;
+#if SD_BOOT_PARALLEL_INIT
+    // The LCD comes up on core1 while this core mounts the card and starts
+    // reading the root directory; the UI is only drawn once both are done
+    multicore_launch_core1(lcd_bring_up);
+    if (sd_card_inserted())
+    {
+        if (SD_STABILIZE_MS > 0)
+            sleep_ms(SD_STABILIZE_MS);
+        mounted = fs_init();
+        BOOT_TRACE_MARK("fs init");
+        if (mounted && dir_listing_open("/sd"))
+        {
+            while (!multicore_fifo_rvalid() && !dir_listing_complete())
+                dir_listing_read_ahead(SD_BOOT_DIR_IDLE_BATCH);
+        }
+    }
+    multicore_fifo_pop_blocking();
+    // Core1 is done with the panel; back in reset it stays out of the way
+    // of the application
+    multicore_reset_core1();
+    BOOT_TRACE_MARK("lcd init");
+#else
+    lcd_bring_up();
+    BOOT_TRACE_MARK("lcd init");
+#endif
+
+    // No card yet, or it did not mount in time: try again with the status on screen
+    if (!mounted)
+    {
+        DEBUG_PRINT("Checking for SD card...\n");
+        text_directory_ui_init();
+        BOOT_TRACE_MARK("ui init");
+        mount_sd_card();
+    }
+
+#if SD_BOOT_AUTOBOOT
+    if (!menu_requested)
+        try_autoboot();
+#endif
+
+    // The screen was cleared above; the UI repaints its own area
     text_directory_ui_init();
+    BOOT_TRACE_MARK("directory listed");
+    BOOT_TRACE_REPORT();
     text_directory_ui_set_final_callback(final_selection_callback);
     text_directory_ui_run();
 }
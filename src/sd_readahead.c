@@ -0,0 +1,186 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * sd_readahead.c
+ *
+ * Sequential read mode under the FAT layer. FatFs asks for the exact
+ * sectors it needs, so an image read through 4KB fread calls reaches the
+ * card as one short transfer per call, each paying for its own command,
+ * response and start token. This block device sits between the filesystem
+ * and blockdevice_sd. When a read continues where the previous one (or the
+ * cached window) ended, a whole window is fetched with one multi-block read
+ * (CMD18 in blockdevice_sd), and the requests that follow are served from
+ * memory. Random reads (FAT and directory sectors) and reads of a window or
+ * more are passed straight through, so they cost no more than before.
+ * Writes go through and drop any cached data they overlap.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#include "debug.h"
+#include "sd_readahead.h"
+
+typedef struct
+{
+    blockdevice_t *device;   // Wrapped device
+    uint8_t *buffer;         // SD_BOOT_READAHEAD_SIZE bytes
+    size_t window;           // Bytes fetched per readahead
+    bd_size_t start, len;    // Range held in buffer (len 0: nothing)
+    bd_size_t next;          // End of the previous read
+} readahead_t;
+
+static readahead_t *config_of(blockdevice_t *bd)
+{
+    return (readahead_t *)bd->config;
+}
+
+static void drop_overlap(readahead_t *ra, bd_size_t addr, bd_size_t length)
+{
+    if (addr < ra->start + ra->len && ra->start < addr + length)
+        ra->len = 0;
+}
+
+static int ra_init(blockdevice_t *bd)
+{
+    readahead_t *ra = config_of(bd);
+    ra->len = 0;
+    int err = ra->device->init(ra->device);
+    bd->is_initialized = ra->device->is_initialized;
+    return err;
+}
+
+static int ra_deinit(blockdevice_t *bd)
+{
+    readahead_t *ra = config_of(bd);
+    ra->len = 0;
+    int err = ra->device->deinit(ra->device);
+    bd->is_initialized = ra->device->is_initialized;
+    return err;
+}
+
+static int ra_read(blockdevice_t *bd, const void *buffer, bd_size_t addr, bd_size_t length)
+{
+    readahead_t *ra = config_of(bd);
+    uint8_t *out = (uint8_t *)buffer;
+
+    bool cached = ra->len > 0 && addr >= ra->start && addr + length <= ra->start + ra->len;
+    bool sequential = addr == ra->next || (ra->len > 0 && addr == ra->start + ra->len);
+    ra->next = addr + length;
+    if (cached)
+    {
+        memcpy(out, ra->buffer + (addr - ra->start), length);
+        return 0;
+    }
+    if (!sequential || length >= ra->window)
+        return ra->device->read(ra->device, buffer, addr, length);
+
+    // Fetch a window from addr, clipped to the end of the card
+    bd_size_t size = ra->device->size(ra->device);
+    bd_size_t fetch = ra->window;
+    if (addr + fetch > size)
+        fetch = size - addr;
+    int err = ra->device->read(ra->device, ra->buffer, addr, fetch);
+    if (err != 0)
+    {
+        ra->len = 0;
+        return err;
+    }
+    ra->start = addr;
+    ra->len = fetch;
+    memcpy(out, ra->buffer, length);
+    return 0;
+}
+
+static int ra_erase(blockdevice_t *bd, bd_size_t addr, bd_size_t length)
+{
+    readahead_t *ra = config_of(bd);
+    drop_overlap(ra, addr, length);
+    return ra->device->erase(ra->device, addr, length);
+}
+
+static int ra_program(blockdevice_t *bd, const void *buffer, bd_size_t addr, bd_size_t length)
+{
+    readahead_t *ra = config_of(bd);
+    drop_overlap(ra, addr, length);
+    return ra->device->program(ra->device, buffer, addr, length);
+}
+
+static int ra_trim(blockdevice_t *bd, bd_size_t addr, bd_size_t length)
+{
+    readahead_t *ra = config_of(bd);
+    drop_overlap(ra, addr, length);
+    return ra->device->trim(ra->device, addr, length);
+}
+
+static int ra_sync(blockdevice_t *bd)
+{
+    readahead_t *ra = config_of(bd);
+    return ra->device->sync(ra->device);
+}
+
+static bd_size_t ra_size(blockdevice_t *bd)
+{
+    readahead_t *ra = config_of(bd);
+    return ra->device->size(ra->device);
+}
+
+blockdevice_t *sd_readahead_create(blockdevice_t *device)
+{
+    blockdevice_t *bd = calloc(1, sizeof(blockdevice_t));
+    readahead_t *ra = calloc(1, sizeof(readahead_t));
+    uint8_t *buffer = malloc(SD_BOOT_READAHEAD_SIZE);
+    if (bd == NULL || ra == NULL || buffer == NULL)
+    {
+        DEBUG_PRINT("readahead: out of memory\n");
+        free(bd);
+        free(ra);
+        free(buffer);
+        return NULL;
+    }
+
+    ra->device = device;
+    ra->buffer = buffer;
+    ra->window = SD_BOOT_READAHEAD_SIZE;
+    ra->next = (bd_size_t)-1;
+
+    bd->init = ra_init;
+    bd->deinit = ra_deinit;
+    bd->read = ra_read;
+    bd->erase = ra_erase;
+    bd->program = ra_program;
+    bd->trim = ra_trim;
+    bd->sync = ra_sync;
+    bd->size = ra_size;
+    bd->read_size = device->read_size;
+    bd->erase_size = device->erase_size;
+    bd->program_size = device->program_size;
+    bd->name = "sd_readahead";
+    bd->config = ra;
+    bd->is_initialized = device->is_initialized;
+    return bd;
+}
+
+void sd_readahead_set_window(blockdevice_t *readahead, size_t size)
+{
+    readahead_t *ra = config_of(readahead);
+    size_t block = readahead->read_size > 0 ? readahead->read_size : 512;
+    if (size > SD_BOOT_READAHEAD_SIZE)
+        size = SD_BOOT_READAHEAD_SIZE;
+    size -= size % block;
+    ra->window = size >= block ? size : block;
+    ra->len = 0;
+}
+
+void sd_readahead_free(blockdevice_t *readahead)
+{
+    readahead_t *ra = config_of(readahead);
+    free(ra->buffer);
+    free(ra);
+    free(readahead);
+}
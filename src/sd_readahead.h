@@ -0,0 +1,24 @@
+/*
+ * sd_readahead.h
+ *
+ */
+
+#ifndef SD_READAHEAD_H
+#define SD_READAHEAD_H
+
+#include <stddef.h>
+#include "blockdevice/blockdevice.h"
+
+// Wrap a block device with a readahead cache of up to SD_BOOT_READAHEAD_SIZE
+// bytes. Returns NULL if there is not enough memory; the device is then
+// used unwrapped.
+blockdevice_t *sd_readahead_create(blockdevice_t *device);
+
+// Set the readahead window, normally the FAT cluster size (rounded down to
+// whole blocks, at most SD_BOOT_READAHEAD_SIZE). Drops the cached data.
+void sd_readahead_set_window(blockdevice_t *readahead, size_t size);
+
+// Free the wrapper and its buffer, not the wrapped device.
+void sd_readahead_free(blockdevice_t *readahead);
+
+#endif // SD_READAHEAD_H
@@ -11,16 +11,24 @@
  * Implementation for the Text Directory UI Navigator.
  *
  * This module provides a text-based UI for navigating directories and files on an SD card.
- * It uses lcdspi APIs for rendering, key_event APIs for input handling, and pico-vfs/standard POSIX APIs
- * for filesystem operations.
+ * It uses lcdspi APIs for rendering, key_event APIs for input handling, and dir_listing (pico-vfs/standard
+ * POSIX APIs) for filesystem operations.
  *
  * Features:
  *  - UI Initialization: Sets up the display, input handling, and mounts the SD card filesystem.
  *  - Directory Navigation: Allows navigation through directories and files using arrow keys.
+ *    Going back selects the directory that was left.
+ *  - Sorted listings: directories first, then by name. Left/Right page, Home/End jump to the
+ *    ends, typing jumps to the first entry starting with the typed letters.
+ *  - Firmware check: .bin files without a valid vector table are marked BAD and cannot be
+ *    selected. TAB toggles listing only directories and firmware images.
+ *    Images already resident in flash have their size marked with '*'.
  *  - File Selection: Invokes a callback when a file is selected.
  *  - Status Messages: Displays temporary status messages at the bottom of the UI.
+ *  - Diagnostics: F1 shows the boot trace when built with SD_BOOT_TRACE.
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,9 +37,11 @@
 #include "lcdspi/lcdspi.h"
 #include "key_event.h"
 #include "text_directory_ui.h"
+#include "config.h"
+#include "ui_canvas.h"
+#include "dir_listing.h"
 #include "debug.h"
-#include <sys/stat.h>
-#include <dirent.h>
+#include "boot_trace.h"
 
 // External functions for SD card handling
 extern bool sd_card_inserted(void);
@@ -51,16 +61,14 @@ extern bool fs_init(void);
 #define COLOR_FG WHITE
 #define COLOR_HIGHLIGHT GREEN
 
-// Maximum number of directory entries
-#define MAX_ENTRIES 128
-
-// Data structure for directory entries
-typedef struct
+// Palette indices used when composing rows with ui_canvas
+enum
 {
-    char name[256];
-    int is_dir; // 1 if directory, 0 if file
-    off_t file_size; // Size of the file in bytes
-} dir_entry_t;
+    PAL_BG,
+    PAL_FG,
+    PAL_HIGHLIGHT,
+};
+static const int ui_palette[] = {COLOR_BG, COLOR_FG, COLOR_HIGHLIGHT};
 
 // UI Layout Constants for file display
 #define FILE_NAME_X (UI_X + 4)
@@ -70,25 +78,55 @@ typedef struct
 #define CHAR_WIDTH 8
 #define FILE_NAME_VISIBLE_CHARS (FILE_NAME_AREA_WIDTH / CHAR_WIDTH)
 #define SCROLL_DELAY_MS 300
+#define TYPEAHEAD_TIMEOUT_MS 1000 // Letters typed within this time form one search prefix
+
+// Directory list layout: each row is a font line plus padding
+#define LIST_FONT_HEIGHT 12
+#define LIST_ENTRY_PADDING 2
+#define LIST_ROW_HEIGHT (LIST_FONT_HEIGHT + LIST_ENTRY_PADDING)
+#define LIST_Y (UI_Y + HEADER_TITLE_HEIGHT + PATH_HEADER_HEIGHT)
+#define LIST_MAX_VISIBLE ((UI_HEIGHT - (HEADER_TITLE_HEIGHT + PATH_HEADER_HEIGHT + STATUS_BAR_HEIGHT)) / LIST_ROW_HEIGHT)
+// The rows (each starting one line above its text) form the hardware scrolling area
+#define LIST_AREA_Y (LIST_Y - 1)
+#define LIST_AREA_HEIGHT (LIST_MAX_VISIBLE * LIST_ROW_HEIGHT)
+
+// What a list row currently shows on the panel
+typedef struct
+{
+    bool valid;
+    int is_selected;
+    char name[FILE_NAME_VISIBLE_CHARS + 1];
+    char size[20];
+} drawn_row_t;
 
 // Global variables for UI state
 static char current_path[512] = "/sd";                   // Current directory path
-static dir_entry_t entries[MAX_ENTRIES];                 // Directory entries
 static int entry_count = 0;                              // Number of entries in the current directory
 static int selected_index = 0;                           // Currently selected entry index
 static char status_message[256] = "";                    // Status message
 static uint32_t status_timestamp = 0;                    // Timestamp for status message
 static final_selection_callback_t final_callback = NULL; // Callback for file selection
+static char typeahead[32] = "";                          // Letters typed so far
+static uint32_t typeahead_timestamp = 0;                 // Time of the last typed letter
+
+// Panel contents, used to send only the rows that changed
+static drawn_row_t drawn_rows[LIST_MAX_VISIBLE];
+static int drawn_start_index = 0;
+static char drawn_path[sizeof(current_path)];
+static char drawn_status[UI_WIDTH / 8];
+static bool drawn_header_valid = false;
+static bool drawn_status_valid = false;
 
 // Forward declarations
 static void ui_refresh(void);
 static void load_directory(const char *path);
+static void ui_fill_listing(void);
 static void process_key_event(int key);
 static void ui_draw_title(void);
 static void ui_draw_path_header(void);
 static void ui_draw_directory_list(void);
-static void ui_draw_directory_entry(int entry_idx, int posY, int font_height, int is_selected);
-static void ui_update_selected_entry(void);
+static void ui_draw_directory_entry(int entry_idx, int row, int is_selected);
+static void ui_invalidate(void);
 static void ui_draw_status_bar(void);
 static void format_file_size(off_t size, int is_dir, char *buf, size_t buf_size);
 static void get_scrolling_text(const char *text, char *out, size_t out_size, int visible_chars);
@@ -151,62 +189,50 @@ static void get_scrolling_text(const char *text, char *out, size_t out_size, int
     out[i] = '\0';
 }
 
-// Load directory entries into the global entries array
+// Make the listing of a directory current and restore the selection remembered for it
 static void load_directory(const char *path)
 {
-    DIR *dir = opendir(path);
-    if (dir == NULL)
+    dir_listing_open(path);
+    selected_index = dir_listing_get_selection();
+    ui_fill_listing();
+    if (selected_index >= entry_count)
+        selected_index = 0;
+}
+
+// Make sure the entries of the visible window, plus some lookahead, have been read.
+// Entries sorted in before the selection move it, so it is passed through the listing.
+static void ui_fill_listing(void)
+{
+    int needed = (selected_index >= LIST_MAX_VISIBLE) ? selected_index + 1 : LIST_MAX_VISIBLE;
+    dir_listing_set_selection(selected_index);
+    entry_count = dir_listing_fill(needed + SD_BOOT_DIR_READAHEAD);
+    selected_index = dir_listing_get_selection();
+    if (selected_index >= entry_count)
+        selected_index = entry_count > 0 ? entry_count - 1 : 0;
+}
+
+// Add a typed character to the search prefix and jump to the first match
+static void ui_type_ahead(char c)
+{
+    uint32_t now = time_us_64() / 1000;
+    size_t len = strlen(typeahead);
+    if (now - typeahead_timestamp > TYPEAHEAD_TIMEOUT_MS)
+        len = 0;
+    if (len < sizeof(typeahead) - 1)
     {
-        entry_count = 0;
-        return;
+        typeahead[len++] = c;
+        typeahead[len] = '\0';
     }
-    entry_count = 0;
-    struct dirent *ent;
-    while ((ent = readdir(dir)) != NULL && entry_count < MAX_ENTRIES)
-    {
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
-            continue;
-        strncpy(entries[entry_count].name, ent->d_name, sizeof(entries[entry_count].name) - 1);
-        entries[entry_count].name[sizeof(entries[entry_count].name) - 1] = '\0';
-
-        // Build full path for stat
-        char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, ent->d_name);
-        
-        // Determine if the entry is a directory and get file size
-        if (ent->d_type != DT_UNKNOWN)
-        {
-            entries[entry_count].is_dir = (ent->d_type == DT_DIR) ? 1 : 0;
-            
-            // Get file size using stat even if we know the type from d_type
-            struct stat statbuf;
-            if (stat(full_path, &statbuf) == 0)
-            {
-                entries[entry_count].file_size = entries[entry_count].is_dir ? 0 : statbuf.st_size;
-            }
-            else
-            {
-                entries[entry_count].file_size = 0;
-            }
-        }
-        else
-        {
-            struct stat statbuf;
-            if (stat(full_path, &statbuf) == 0)
-            {
-                entries[entry_count].is_dir = S_ISDIR(statbuf.st_mode) ? 1 : 0;
-                entries[entry_count].file_size = entries[entry_count].is_dir ? 0 : statbuf.st_size;
-            }
-            else
-            {
-                entries[entry_count].is_dir = 0;
-                entries[entry_count].file_size = 0;
-            }
-        }
-        entry_count++;
-    }
-    closedir(dir);
-    selected_index = 0;
+    typeahead_timestamp = now;
+
+    int index = dir_listing_search(typeahead);
+    entry_count = dir_listing_count();
+    if (index >= 0)
+        selected_index = index;
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Find: %s", typeahead);
+    text_directory_ui_set_status(msg);
 }
 
 // Draw the title header
@@ -222,32 +248,58 @@ static void ui_draw_path_header(void)
     char path_header[300];
     snprintf(path_header, sizeof(path_header), "Path: %s", current_path);
     int y = UI_Y + HEADER_TITLE_HEIGHT;
-    draw_rect_spi(UI_X, y, UI_X + UI_WIDTH - 1, y + PATH_HEADER_HEIGHT - 1, COLOR_BG);
-    draw_text(UI_X + 2, y + 2, path_header, COLOR_FG, COLOR_BG);
-    draw_line_spi(UI_X, y + PATH_HEADER_HEIGHT - 2, UI_X + UI_WIDTH - 1, y + PATH_HEADER_HEIGHT - 2, COLOR_FG);
+    if (drawn_header_valid && strcmp(drawn_path, current_path) == 0)
+        return;
+
+    // The last header line belongs to the first list row
+    ui_canvas_begin(PATH_HEADER_HEIGHT - 1, PAL_BG);
+    ui_canvas_text(2, 2, path_header, PAL_FG, PAL_BG);
+    ui_canvas_fill(0, PATH_HEADER_HEIGHT - 2, UI_WIDTH, 1, PAL_FG);
+    ui_canvas_flush(UI_X, y);
+
+    strcpy(drawn_path, current_path);
+    drawn_header_valid = true;
+}
+
+// Forget what is on the panel, so the next draw sends every part of the UI
+static void ui_invalidate(void)
+{
+    for (int i = 0; i < LIST_MAX_VISIBLE; i++)
+        drawn_rows[i].valid = false;
+    drawn_header_valid = false;
+    drawn_status_valid = false;
 }
 
 /**
  * Draw a single directory entry
+ * The row is composed off-screen and only sent when it differs from what the panel shows.
  * 
- * @param entry_idx Index of the entry in the entries array
- * @param posY Vertical position to draw the entry
- * @param font_height Height of the font
+ * @param entry_idx Index of the entry in the entries array, -1 for an empty row
+ * @param row Visible row to draw the entry in
  * @param is_selected Whether this entry is currently selected
  */
-static void ui_draw_directory_entry(int entry_idx, int posY, int font_height, int is_selected)
+static void ui_draw_directory_entry(int entry_idx, int row, int is_selected)
 {
-    // Highlight background for selected item
-    if (is_selected)
+    drawn_row_t *drawn = &drawn_rows[row];
+    int posY = LIST_Y + row * LIST_ROW_HEIGHT;
+
+    if (entry_idx < 0)
     {
-        draw_rect_spi(UI_X, posY - 1, UI_X + UI_WIDTH - 1, posY + font_height, COLOR_HIGHLIGHT);
+        if (drawn->valid && !drawn->is_selected && drawn->name[0] == '\0' && drawn->size[0] == '\0')
+            return;
+        ui_canvas_begin(LIST_ROW_HEIGHT, PAL_BG);
+        ui_canvas_flush(UI_X, posY - 1);
+        drawn->valid = true;
+        drawn->is_selected = 0;
+        drawn->name[0] = drawn->size[0] = '\0';
+        return;
     }
-    
+
     // Prepare filename with directory indicator
     char full_file_name[300];
     snprintf(full_file_name, sizeof(full_file_name), "%s%s", 
-            entries[entry_idx].name, 
-            entries[entry_idx].is_dir ? "/" : "");
+            dir_listing_name(entry_idx), 
+            dir_listing_is_dir(entry_idx) ? "/" : "");
     
     // Prepare display text with scrolling for selected items
     char display_buffer[300];
@@ -275,61 +327,73 @@ static void ui_draw_directory_entry(int entry_idx, int posY, int font_height, in
     
     // Format and display file size
     char size_buffer[20];
-    format_file_size(entries[entry_idx].file_size, entries[entry_idx].is_dir, 
+    // Sizes are only fetched for the rows that are displayed
+    format_file_size(dir_listing_file_size(entry_idx), dir_listing_is_dir(entry_idx), 
                     size_buffer, sizeof(size_buffer));
+    if (dir_listing_image_state(entry_idx) == DIR_IMAGE_INVALID)
+        snprintf(size_buffer, sizeof(size_buffer), "BAD");
+    else if (dir_listing_is_resident(entry_idx))
+    {
+        // Already in flash: launched without loading it again
+        char size_text[sizeof(size_buffer) - 1];
+        strcpy(size_text, size_buffer);
+        snprintf(size_buffer, sizeof(size_buffer), "*%s", size_text);
+    }
     
-    // Draw filename and file size
-    draw_text(FILE_NAME_X, posY, display_buffer, COLOR_FG, is_selected ? COLOR_HIGHLIGHT : COLOR_BG);
-    draw_text(FILE_SIZE_X, posY, size_buffer, COLOR_FG, is_selected ? COLOR_HIGHLIGHT : COLOR_BG);
-}
+    display_buffer[FILE_NAME_VISIBLE_CHARS] = '\0';
+    if (drawn->valid && drawn->is_selected == is_selected &&
+        strcmp(drawn->name, display_buffer) == 0 && strcmp(drawn->size, size_buffer) == 0)
+        return;
 
-/**
- * Update only the selected entry row
- * This is an optimization to avoid redrawing the entire directory list
- * when only the selected entry needs to be updated (e.g., for scrolling text)
- */
-static void ui_update_selected_entry(void)
-{
-    const int font_height = 12;
-    const int entry_padding = 2;
-    int y_start = UI_Y + HEADER_TITLE_HEIGHT + PATH_HEADER_HEIGHT;
-    int available_height = UI_HEIGHT - (HEADER_TITLE_HEIGHT + PATH_HEADER_HEIGHT + STATUS_BAR_HEIGHT);
-    int max_visible = available_height / (font_height + entry_padding);
-    int start_index = (selected_index >= max_visible) ? selected_index - max_visible + 1 : 0;
-    
-    // Calculate the position of the selected entry
-    int visible_index = selected_index - start_index;
-    if (visible_index >= 0 && visible_index < max_visible) {
-        int posY = y_start + visible_index * (font_height + entry_padding);
-        
-        // Clear just the selected row
-        draw_rect_spi(UI_X, posY - 1, UI_X + UI_WIDTH - 1, posY + font_height, COLOR_BG);
-        
-        // Redraw just the selected entry
-        ui_draw_directory_entry(selected_index, posY, font_height, 1);
-    }
+    // Compose the row (highlight background for the selected item) and send it
+    uint8_t bg = is_selected ? PAL_HIGHLIGHT : PAL_BG;
+    ui_canvas_begin(LIST_ROW_HEIGHT, bg);
+    ui_canvas_text(FILE_NAME_X - UI_X, 1, display_buffer, PAL_FG, bg);
+    ui_canvas_text(FILE_SIZE_X - UI_X, 1, size_buffer, PAL_FG, bg);
+    ui_canvas_flush(UI_X, posY - 1);
+
+    drawn->valid = true;
+    drawn->is_selected = is_selected;
+    strcpy(drawn->name, display_buffer);
+    strncpy(drawn->size, size_buffer, sizeof(drawn->size));
 }
 
-// Draw the directory list
+// Draw the directory list; rows that did not change are not sent again, so
+// moving the selection by one redraws just the old and the new selected row
 static void ui_draw_directory_list(void)
 {
-    const int font_height = 12;
-    const int entry_padding = 2;
-    int y_start = UI_Y + HEADER_TITLE_HEIGHT + PATH_HEADER_HEIGHT;
-    int available_height = UI_HEIGHT - (HEADER_TITLE_HEIGHT + PATH_HEADER_HEIGHT + STATUS_BAR_HEIGHT);
-    int max_visible = available_height / (font_height + entry_padding);
-    int start_index = (selected_index >= max_visible) ? selected_index - max_visible + 1 : 0;
+    int start_index = (selected_index >= LIST_MAX_VISIBLE) ? selected_index - LIST_MAX_VISIBLE + 1 : 0;
 
-    draw_rect_spi(UI_X, y_start, UI_X + UI_WIDTH - 1, UI_Y + UI_HEIGHT - STATUS_BAR_HEIGHT - 1, COLOR_BG);
+    // When the window moves, scroll the rows that stay visible in hardware so only
+    // the rows coming into view have to be drawn
+    int delta = start_index - drawn_start_index;
+    drawn_start_index = start_index;
+    if (delta != 0 && delta > -LIST_MAX_VISIBLE && delta < LIST_MAX_VISIBLE)
+    {
+        lcd_scroll_area(delta * LIST_ROW_HEIGHT);
+        if (delta > 0)
+        {
+            memmove(&drawn_rows[0], &drawn_rows[delta], (LIST_MAX_VISIBLE - delta) * sizeof(drawn_row_t));
+            for (int i = LIST_MAX_VISIBLE - delta; i < LIST_MAX_VISIBLE; i++)
+                drawn_rows[i].valid = false;
+        }
+        else
+        {
+            memmove(&drawn_rows[-delta], &drawn_rows[0], (LIST_MAX_VISIBLE + delta) * sizeof(drawn_row_t));
+            for (int i = 0; i < -delta; i++)
+                drawn_rows[i].valid = false;
+        }
+    }
 
-    for (int i = 0; i < max_visible && (i + start_index) < entry_count; i++)
+    for (int i = 0; i < LIST_MAX_VISIBLE; i++)
     {
-        int posY = y_start + i * (font_height + entry_padding);
         int entry_idx = i + start_index;
+        if (entry_idx >= entry_count)
+            entry_idx = -1;
         int is_selected = (entry_idx == selected_index);
         
         // Draw the entry using the helper function
-        ui_draw_directory_entry(entry_idx, posY, font_height, is_selected);
+        ui_draw_directory_entry(entry_idx, i, is_selected);
     }
 }
 
@@ -337,12 +401,19 @@ static void ui_draw_directory_list(void)
 static void ui_draw_status_bar(void)
 {
     int y = UI_Y + UI_HEIGHT - STATUS_BAR_HEIGHT;
-    draw_rect_spi(UI_X, y, UI_X + UI_WIDTH - 1, UI_Y + UI_HEIGHT - 1, COLOR_BG);
-    draw_line_spi(UI_X, y, UI_X + UI_WIDTH - 1, y, COLOR_FG);
     char truncated_message[UI_WIDTH / 8];
     strncpy(truncated_message, status_message, sizeof(truncated_message) - 1);
     truncated_message[sizeof(truncated_message) - 1] = '\0';
-    draw_text(UI_X + 2, y + 2, truncated_message, COLOR_FG, COLOR_BG);
+    if (drawn_status_valid && strcmp(drawn_status, truncated_message) == 0)
+        return;
+
+    ui_canvas_begin(STATUS_BAR_HEIGHT, PAL_BG);
+    ui_canvas_fill(0, 0, UI_WIDTH, 1, PAL_FG);
+    ui_canvas_text(2, 2, truncated_message, PAL_FG, PAL_BG);
+    ui_canvas_flush(UI_X, y);
+
+    strcpy(drawn_status, truncated_message);
+    drawn_status_valid = true;
 }
 
 // Refresh the entire UI
@@ -360,6 +431,31 @@ static void ui_refresh(void)
     }
 }
 
+#if SD_BOOT_TRACE
+// Diagnostics screen: the boot trace over the list area until a key is pressed
+static void ui_show_trace(void)
+{
+    int y = LIST_AREA_Y;
+    char line[UI_WIDTH / 8];
+    draw_filled_rect(UI_X, LIST_AREA_Y, UI_WIDTH, LIST_AREA_HEIGHT, BLACK);
+    draw_text(UI_X + 2, y, "Boot trace (ms, +ms) - any key", WHITE, BLACK);
+    y += LIST_ROW_HEIGHT;
+    for (int i = 0; y + LIST_FONT_HEIGHT <= LIST_AREA_Y + LIST_AREA_HEIGHT && boot_trace_line(i, line, sizeof(line)); i++)
+    {
+        draw_text(UI_X + 2, y, line, WHITE, BLACK);
+        y += LIST_FONT_HEIGHT;
+    }
+    BOOT_TRACE_REPORT();
+
+    while (keypad_get_key() == 0)
+        sleep_ms(5);
+
+    draw_filled_rect(UI_X, LIST_AREA_Y, UI_WIDTH, LIST_AREA_HEIGHT, COLOR_BG);
+    ui_invalidate();
+    ui_refresh();
+}
+#endif
+
 // Handle key events for navigation and selection
 static void process_key_event(int key)
 {
@@ -373,42 +469,117 @@ static void process_key_event(int key)
     case KEY_ARROW_DOWN:
         if (selected_index < entry_count - 1)
             selected_index++;
+        ui_fill_listing();
         ui_draw_directory_list();
         break;
     case KEY_ENTER:
         if (entry_count > 0)
         {
             char new_path[512];
-            if (entries[selected_index].is_dir)
+            const char *name = dir_listing_name(selected_index);
+            dir_listing_set_selection(selected_index);
+            if (dir_listing_is_dir(selected_index))
             {
-                snprintf(new_path, sizeof(new_path), "%s/%s", current_path, entries[selected_index].name);
+                snprintf(new_path, sizeof(new_path), "%s/%s", current_path, name);
                 strncpy(current_path, new_path, sizeof(current_path) - 1);
                 load_directory(current_path);
                 ui_draw_path_header();
                 ui_draw_directory_list();
             }
+            else if (dir_listing_image_state(selected_index) == DIR_IMAGE_INVALID)
+            {
+                // Not worth an erase cycle
+                text_directory_ui_set_status("Err: not a valid firmware image");
+            }
             else if (final_callback)
             {
                 char final_selected[512];
-                snprintf(final_selected, sizeof(final_selected), "%s/%s", current_path, entries[selected_index].name);
+                char selected_name[256];
+                snprintf(final_selected, sizeof(final_selected), "%s/%s", current_path, name);
+                strncpy(selected_name, name, sizeof(selected_name) - 1);
+                selected_name[sizeof(selected_name) - 1] = '\0';
+
+                // Leave the heap to the flash pipeline while the image is loaded
+                dir_listing_invalidate();
                 final_callback(final_selected);
+
+                // Back here if the image was not launched: read the directory again
+                load_directory(current_path);
+                int index = dir_listing_find(selected_name);
+                if (index >= 0)
+                    selected_index = index;
+                ui_fill_listing();
+                ui_draw_directory_list();
             }
         }
         break;
     case KEY_BACKSPACE:
         if (strcmp(current_path, "/sd") != 0)
         {
+            char child[256] = "";
             char *last_slash = strrchr(current_path, '/');
+            dir_listing_set_selection(selected_index);
             if (last_slash)
+            {
+                strncpy(child, last_slash + 1, sizeof(child) - 1);
                 *last_slash = '\0';
+            }
             if (current_path[0] == '\0')
                 strncpy(current_path, "/sd", sizeof(current_path) - 1);
             load_directory(current_path);
+
+            // Select the directory we came from
+            int child_index = dir_listing_find(child);
+            if (child_index >= 0)
+                selected_index = child_index;
+            ui_fill_listing();
             ui_draw_path_header();
             ui_draw_directory_list();
         }
         break;
+    case KEY_ARROW_LEFT:
+        selected_index = (selected_index > LIST_MAX_VISIBLE) ? selected_index - LIST_MAX_VISIBLE : 0;
+        ui_draw_directory_list();
+        break;
+    case KEY_ARROW_RIGHT:
+        selected_index += LIST_MAX_VISIBLE;
+        ui_fill_listing();
+        ui_draw_directory_list();
+        break;
+    case KEY_TAB:
+    {
+        char selected_name[256] = "";
+        if (entry_count > 0)
+            strncpy(selected_name, dir_listing_name(selected_index), sizeof(selected_name) - 1);
+        dir_listing_set_firmware_only(!dir_listing_get_firmware_only());
+        load_directory(current_path);
+        int index = dir_listing_find(selected_name);
+        selected_index = index >= 0 ? index : 0;
+        ui_fill_listing();
+        ui_draw_directory_list();
+        text_directory_ui_set_status(dir_listing_get_firmware_only() ? "Showing firmware only" : "Showing all files");
+        break;
+    }
+    case KEY_HOME:
+        selected_index = 0;
+        ui_draw_directory_list();
+        break;
+    case KEY_END:
+        entry_count = dir_listing_fill(INT_MAX);
+        selected_index = entry_count > 0 ? entry_count - 1 : 0;
+        ui_draw_directory_list();
+        break;
+#if SD_BOOT_TRACE
+    case KEY_F1:
+        ui_show_trace();
+        break;
+#endif
     default:
+        if (key > ' ' && key < 0x7F)
+        {
+            ui_type_ahead((char)key);
+            ui_draw_directory_list();
+        }
         break;
     }
     ui_draw_status_bar();
@@ -423,7 +594,11 @@ void text_directory_ui_set_final_callback(final_selection_callback_t callback)
 // Public API: Initialize the UI
 bool text_directory_ui_init(void)
 {
+    ui_canvas_set_palette(ui_palette, sizeof(ui_palette) / sizeof(ui_palette[0]));
+    lcd_set_scroll_area(LIST_AREA_Y, LIST_AREA_HEIGHT);
+    drawn_start_index = 0;
     draw_filled_rect(UI_X, UI_Y, UI_WIDTH, UI_HEIGHT, COLOR_BG);
+    ui_invalidate();
     strncpy(current_path, "/sd", sizeof(current_path));
     load_directory(current_path);
     ui_refresh();
@@ -450,6 +625,17 @@ void text_directory_ui_run(void)
         int key = keypad_get_key();
         if (key != 0)
             process_key_event(key);
+        else if (!dir_listing_complete())
+        {
+            // Keep reading a large directory while the user looks at the first entries
+            dir_listing_set_selection(selected_index);
+            if (dir_listing_read_ahead(SD_BOOT_DIR_IDLE_BATCH))
+            {
+                entry_count = dir_listing_count();
+                selected_index = dir_listing_get_selection();
+                ui_draw_directory_list();
+            }
+        }
 
         uint32_t current_time = time_us_64() / 1000;
         
@@ -458,9 +644,9 @@ void text_directory_ui_run(void)
         {
             // Only update the selected entry row if there are entries and a selected item might need scrolling
             if (entry_count > 0 && selected_index >= 0 && 
-                strlen(entries[selected_index].name) + (entries[selected_index].is_dir ? 1 : 0) > FILE_NAME_VISIBLE_CHARS)
+                strlen(dir_listing_name(selected_index)) + (dir_listing_is_dir(selected_index) ? 1 : 0) > FILE_NAME_VISIBLE_CHARS)
             {
-                ui_update_selected_entry();
+                ui_draw_directory_list();
             }
             last_scroll_update = current_time;
         }
@@ -489,13 +675,14 @@ void text_directory_ui_run(void)
                 watchdog_reboot(0, 0, 0);
             }
             
-            // Refresh the directory listing
+            // Refresh the directory listing; the cached ones may be stale
+            dir_listing_invalidate();
             load_directory(current_path);
             ui_draw_path_header();
             ui_draw_directory_list();
             text_directory_ui_set_status("SD card remounted successfully.");
         }
 
-        sleep_ms(20); // Shorter sleep to make scrolling smoother
+        sleep_ms(5); // Keys are polled in the background, this only paces the loop
     }
 }
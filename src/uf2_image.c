@@ -0,0 +1,165 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * uf2_image.c
+ *
+ * Loading of UF2 application images, the format the Pico SDK builds for
+ * the BOOTSEL drive, so build artifacts can be copied to the card unchanged.
+ *
+ * A UF2 file is a sequence of 512-byte blocks, each carrying up to 476 bytes
+ * of payload (256 from the SDK) and its target address. Blocks are read
+ * UF2_READ_BLOCKS at a time and written through the flash writer at their
+ * address; the writer seeks over the gaps between ranges, so sectors that
+ * no block touches are never erased. Blocks for other chips or families
+ * (e.g. the RP2350-E10 workaround block picotool puts first) are skipped.
+ * The blocks must lie in the slot the image is linked for, like a .bin image.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "config.h"
+#include "debug.h"
+#include "flash_writer.h"
+#include "uf2_image.h"
+#include "boot_trace.h"
+
+#define UF2_MAGIC_START0      0x0A324655u
+#define UF2_MAGIC_START1      0x9E5D5157u
+#define UF2_MAGIC_END         0x0AB16F30u
+#define UF2_FLAG_NOT_MAIN     0x00000001u
+#define UF2_FLAG_FAMILY_ID    0x00002000u
+#define UF2_MAX_PAYLOAD       476
+
+#if PICO_RP2040
+#define UF2_FAMILY            0xE48BFF56u // RP2040
+#else
+#define UF2_FAMILY            0xE48BFF59u // RP2350 Arm secure
+#endif
+
+#define UF2_READ_BLOCKS       8
+
+typedef struct
+{
+    uint32_t magic_start0;
+    uint32_t magic_start1;
+    uint32_t flags;
+    uint32_t target_addr;
+    uint32_t payload_size;
+    uint32_t block_no;
+    uint32_t num_blocks;
+    uint32_t family_id;   // File size when UF2_FLAG_FAMILY_ID is not set
+    uint8_t data[UF2_MAX_PAYLOAD];
+    uint32_t magic_end;
+} uf2_block_t;
+
+_Static_assert(sizeof(uf2_block_t) == 512, "UF2 blocks are 512 bytes");
+
+bool uf2_image_is_name(const char *name)
+{
+    size_t len = strlen(name), ext_len = strlen(UF2_IMAGE_EXTENSION);
+    return len >= ext_len && strcmp(name + len - ext_len, UF2_IMAGE_EXTENSION) == 0;
+}
+
+static bool is_valid_block(const uf2_block_t *b)
+{
+    return b->magic_start0 == UF2_MAGIC_START0 && b->magic_start1 == UF2_MAGIC_START1 &&
+           b->magic_end == UF2_MAGIC_END && b->payload_size <= UF2_MAX_PAYLOAD;
+}
+
+// Blocks to be written on this chip; without a family ID every flash block is
+static bool is_own_block(const uf2_block_t *b)
+{
+    if (b->flags & UF2_FLAG_NOT_MAIN)
+        return false;
+    return !(b->flags & UF2_FLAG_FAMILY_ID) || b->family_id == UF2_FAMILY;
+}
+
+// First block of a file normally is the vector table; the E10 block may come first
+#define UF2_PEEK_BLOCKS 4
+
+bool uf2_image_peek(FILE *fp, uint32_t *image_size, uint8_t *head, size_t len)
+{
+    uf2_block_t block;
+    for (int i = 0; i < UF2_PEEK_BLOCKS; i++)
+    {
+        if (fread(&block, 1, sizeof(block), fp) != sizeof(block) || !is_valid_block(&block))
+            return false;
+        if (!is_own_block(&block))
+            continue;
+
+        *image_size = block.num_blocks * block.payload_size;
+        if (head == NULL)
+            return true;
+        // The vector table is at the start of a slot
+        uint32_t offset = block.target_addr - (XIP_BASE + SD_BOOT_FLASH_OFFSET);
+        if (block.target_addr < XIP_BASE + SD_BOOT_FLASH_OFFSET || offset % SD_BOOT_APP_SLOT_SIZE != 0 ||
+            len > block.payload_size)
+            return false;
+        memcpy(head, block.data, len);
+        return true;
+    }
+    return false;
+}
+
+bool uf2_image_load(FILE *fp, uint32_t link_base, uint32_t max_size, uint32_t *image_size)
+{
+    uf2_block_t *blocks = malloc(UF2_READ_BLOCKS * sizeof(uf2_block_t));
+    if (blocks == NULL)
+    {
+        DEBUG_PRINT("uf2: out of memory\n");
+        return false;
+    }
+
+    const uint32_t app_start = link_base;
+    const uint32_t app_end = link_base + max_size;
+    uint32_t end = 0;
+    int written = 0, skipped = 0;
+    bool ok = true;
+    size_t n;
+    while (ok && (n = fread(blocks, sizeof(uf2_block_t), UF2_READ_BLOCKS, fp)) > 0)
+    {
+        BOOT_TRACE_ADD(TRACE_BYTES_READ, n * sizeof(uf2_block_t));
+        for (size_t i = 0; i < n && ok; i++)
+        {
+            const uf2_block_t *b = &blocks[i];
+            if (!is_valid_block(b))
+            {
+                DEBUG_PRINT("uf2: bad block %d\n", written + skipped);
+                ok = false;
+            }
+            else if (!is_own_block(b))
+            {
+                skipped++;
+            }
+            else if (b->target_addr < app_start || b->target_addr + b->payload_size > app_end)
+            {
+                DEBUG_PRINT("uf2: block at %08x outside the slot\n", (unsigned)b->target_addr);
+                ok = false;
+            }
+            else
+            {
+                ok = flash_writer_seek(b->target_addr - app_start) &&
+                     flash_writer_write(b->data, b->payload_size);
+                if (b->target_addr + b->payload_size - app_start > end)
+                    end = b->target_addr + b->payload_size - app_start;
+                written++;
+            }
+        }
+    }
+
+    if (ok && (ferror(fp) || written == 0))
+    {
+        DEBUG_PRINT("uf2: read error or no blocks for this chip\n");
+        ok = false;
+    }
+    DEBUG_PRINT("uf2: %d blocks written, %d skipped\n", written, skipped);
+    free(blocks);
+    *image_size = end;
+    return ok;
+}
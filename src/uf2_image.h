@@ -0,0 +1,33 @@
+/*
+ * uf2_image.h
+ *
+ */
+
+#ifndef UF2_IMAGE_H
+#define UF2_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define UF2_IMAGE_EXTENSION ".uf2"
+
+// Check whether a file name has the UF2 suffix
+bool uf2_image_is_name(const char *name);
+
+// Look at the first block for this chip at the current file position. Its
+// block count gives an estimate of the image size in *image_size. If head is
+// given, the first len bytes of the block's payload are copied into it; false
+// if that block does not start at an application slot.
+bool uf2_image_peek(FILE *fp, uint32_t *image_size, uint8_t *head, size_t len);
+
+// Write the blocks for this chip at the current file position through the
+// flash writer. The image is linked for the XIP address link_base and may be
+// max_size bytes; the writer's start corresponds to link_base. The size from
+// link_base to the end of the highest block is returned in *image_size.
+// Returns false on a read error, a malformed block, a block outside the
+// linked range or blocks in descending order.
+bool uf2_image_load(FILE *fp, uint32_t link_base, uint32_t max_size, uint32_t *image_size);
+
+#endif // UF2_IMAGE_H
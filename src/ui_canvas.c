@@ -0,0 +1,113 @@
+/**
+ * PicoCalc SD Firmware Loader
+ *
+ * Author: Hsuan Han Lai
+ * Email: hsuan.han.lai@gmail.com
+ * Website: https://hsuanhanlai.com
+ * Year: 2025
+ *
+ * ui_canvas.c
+ *
+ * Off-screen strip compositor for the directory UI.
+ *
+ * A UI row is composed in RAM with one palette index per pixel (the UI uses only a
+ * handful of colours) and sent to the panel in a single window. Each pixel is written
+ * once with its final colour, so there is no clear-then-draw flicker, and callers only
+ * flush the rows whose content changed.
+ */
+
+#include <string.h>
+#include "lcdspi/lcdspi.h"
+#include "ui_canvas.h"
+
+static uint8_t pixels[UI_CANVAS_MAX_HEIGHT][UI_CANVAS_WIDTH];
+static unsigned char rgb[UI_CANVAS_MAX_HEIGHT * UI_CANVAS_WIDTH * 3];
+static unsigned char palette[UI_CANVAS_MAX_COLOURS][3];
+static int canvas_height = 0;
+
+void ui_canvas_set_palette(const int *colours, int count)
+{
+    if (count > UI_CANVAS_MAX_COLOURS)
+        count = UI_CANVAS_MAX_COLOURS;
+    for (int i = 0; i < count; i++)
+    {
+        palette[i][0] = colours[i] >> 16;
+        palette[i][1] = (colours[i] >> 8) & 0xFF;
+        palette[i][2] = colours[i] & 0xFF;
+    }
+}
+
+void ui_canvas_begin(int height, uint8_t bg)
+{
+    if (height > UI_CANVAS_MAX_HEIGHT)
+        height = UI_CANVAS_MAX_HEIGHT;
+    canvas_height = height;
+    memset(pixels, bg, sizeof(pixels[0]) * height);
+}
+
+void ui_canvas_fill(int x, int y, int width, int height, uint8_t colour)
+{
+    int x2 = x + width, y2 = y + height;
+    if (x < 0)
+        x = 0;
+    if (y < 0)
+        y = 0;
+    if (x2 > UI_CANVAS_WIDTH)
+        x2 = UI_CANVAS_WIDTH;
+    if (y2 > canvas_height)
+        y2 = canvas_height;
+    for (; y < y2; y++)
+    {
+        if (x < x2)
+            memset(&pixels[y][x], colour, x2 - x);
+    }
+}
+
+void ui_canvas_text(int x, int y, const char *text, uint8_t fg, uint8_t bg)
+{
+    const unsigned char *fp = MainFont;
+    int width = fp[0], height = fp[1];
+
+    for (; *text && x + width <= UI_CANVAS_WIDTH; text++, x += width)
+    {
+        unsigned char c = *text;
+        const unsigned char *glyph = NULL;
+        if (c >= fp[2] && c < fp[2] + fp[3])
+            glyph = fp + 4 + ((c - fp[2]) * height * width) / 8;
+
+        for (int row = 0; row < height; row++)
+        {
+            if (y + row < 0 || y + row >= canvas_height)
+                continue;
+            uint8_t *out = &pixels[y + row][x];
+            for (int col = 0; col < width; col++)
+            {
+                // Same bit order as draw_bitmap_spi(); characters not in the font print as a space
+                int bit = row * width + col;
+                int set = glyph && ((glyph[bit / 8] >> ((height * width - bit - 1) % 8)) & 1);
+                out[col] = set ? fg : bg;
+            }
+        }
+    }
+}
+
+void ui_canvas_flush(int x, int y)
+{
+    if (canvas_height == 0)
+        return;
+
+    // The RGB buffer may still be in flight from the previous flush
+    lcd_wait_idle();
+    unsigned char *out = rgb;
+    for (int row = 0; row < canvas_height; row++)
+    {
+        for (int col = 0; col < UI_CANVAS_WIDTH; col++)
+        {
+            const unsigned char *c = palette[pixels[row][col]];
+            *out++ = c[0];
+            *out++ = c[1];
+            *out++ = c[2];
+        }
+    }
+    draw_rgb888_spi(x, y, x + UI_CANVAS_WIDTH - 1, y + canvas_height - 1, rgb);
+}
@@ -0,0 +1,31 @@
+/*
+ * ui_canvas.h
+ *
+ */
+
+#ifndef UI_CANVAS_H
+#define UI_CANVAS_H
+
+#include <stdint.h>
+
+// Size of the strip being composed (one UI row or bar)
+#define UI_CANVAS_WIDTH 280
+#define UI_CANVAS_MAX_HEIGHT 16
+#define UI_CANVAS_MAX_COLOURS 8
+
+// Set the RGB colours (RGB() values) the palette indices stand for
+void ui_canvas_set_palette(const int *colours, int count);
+
+// Start composing a strip of the given height, filled with palette index bg
+void ui_canvas_begin(int height, uint8_t bg);
+
+// Fill a rectangle of the strip, clipped to its bounds
+void ui_canvas_fill(int x, int y, int width, int height, uint8_t colour);
+
+// Draw text with the LCD font at x, y in the strip; characters past the edge are clipped
+void ui_canvas_text(int x, int y, const char *text, uint8_t fg, uint8_t bg);
+
+// Send the composed strip to the panel with its top left corner at x, y
+void ui_canvas_flush(int x, int y);
+
+#endif // UI_CANVAS_H